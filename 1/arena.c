@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN 64
+
+// the header takes the first cache line of a mapping
+struct arena_block
+{
+    arena_block *prev;
+    size_t size; // of the mapping, the header included
+};
+
+static size_t align_up(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+void arena_init(arena *arena, size_t size)
+{
+    arena->block = NULL;
+    arena->block_size = size;
+    arena->used = 0;
+    arena->allocations = arena->allocated_bytes = 0;
+}
+
+static void arena_map(arena *arena, size_t size)
+{
+    if (size < arena->block_size)
+        size = arena->block_size;
+    size = align_up(size + ARENA_ALIGN, sysconf(_SC_PAGESIZE));
+    arena_block *block = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (block == MAP_FAILED) {
+        perror("arena");
+        exit(1);
+    }
+    block->prev = arena->block;
+    block->size = size;
+    arena->block = block;
+    arena->used = ARENA_ALIGN;
+}
+
+void* arena_alloc(arena *arena, size_t size)
+{
+    size = align_up(size ? size : 1, ARENA_ALIGN);
+    if (!arena->block || arena->block->size - arena->used < size)
+        arena_map(arena, size);
+
+    void *ptr = (char *)arena->block + arena->used;
+    arena->used += size;
+    arena->allocations++;
+    arena->allocated_bytes += size;
+    return ptr;
+}
+
+void arena_discard(void *ptr, size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = align_up((uintptr_t)ptr, page);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(page - 1);
+    // the pages read back as zeros if the range is ever touched again
+    if (begin < end)
+        madvise((void *)begin, end - begin, MADV_DONTNEED);
+}
+
+void arena_free(arena *arena)
+{
+    while (arena->block) {
+        arena_block *prev = arena->block->prev;
+        munmap(arena->block, arena->block->size);
+        arena->block = prev;
+    }
+    arena->used = 0;
+}
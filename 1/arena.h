@@ -0,0 +1,30 @@
+#ifndef SORT_ARENA_H
+#define SORT_ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator of the buffers of one file. They are carved out of an
+// anonymous mapping and all of them are unmapped at once. The mapping only
+// reserves address space, pages are backed as they are touched, so it may be
+// sized for the worst case of the file. A request that doesn't fit gets a
+// mapping of its own.
+typedef struct arena_block arena_block;
+
+typedef struct arena
+{
+    arena_block *block;     // the current one, it links the ones before it
+    size_t block_size;      // the least size of a mapping
+    size_t used;            // bytes of the current block handed out
+    size_t allocations, allocated_bytes; // arena_alloc() calls so far
+} arena;
+
+// nothing is mapped until the first allocation
+void arena_init(arena *arena, size_t size);
+// the memory is aligned to a cache line, exits on failure
+void* arena_alloc(arena *arena, size_t size);
+// gives the whole pages of an allocation no longer used back to the system,
+// its address range stays reserved until arena_free()
+void arena_discard(void *ptr, size_t size);
+void arena_free(arena *arena);
+
+#endif
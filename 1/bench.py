@@ -0,0 +1,133 @@
+import argparse
+import json
+import os
+import shlex
+import statistics
+import subprocess
+import sys
+import tempfile
+
+# Runs the sorter on generated datasets and prints the median of its --stats
+# as JSON, every dataset is split into several files of the same distribution.
+
+distributions = ['uniform', 'sorted', 'reverse', 'nearly-sorted', 'appended',
+		 'few-unique', 'skewed']
+
+parser = argparse.ArgumentParser(description = "Benchmark the sorter")
+parser.add_argument('-s', type=str, default='100000,1000000',
+		    help='comma separated dataset sizes, numbers in all the files')
+parser.add_argument('-d', type=str, default=','.join(distributions),
+		    help='comma separated distributions, see generator.py -d')
+parser.add_argument('-f', type=int, default=4, help='files per dataset')
+parser.add_argument('-r', type=int, default=3, help='runs of every configuration')
+parser.add_argument('-a', type=str, action='append',
+		    help='sorter options of a configuration, e.g. "-j 4 --radix", '\
+			 'may be repeated, the default options otherwise')
+parser.add_argument('-t', type=str, default='int32',
+		    choices=['int32', 'int64', 'record'], help='element type')
+parser.add_argument('-l', type=int, default=1000, help='target latency, us')
+parser.add_argument('-o', type=str, help='write the results to this file '\
+					 'instead of stdout')
+parser.add_argument('-b', type=str, help='results of an earlier run to '\
+					 'compare with, the exit code is 1 if '\
+					 'a configuration got slower')
+parser.add_argument('-x', type=float, default=10.0,
+		    help='percent of total_us a configuration may lose '\
+			 'against -b before it counts as a regression')
+args = parser.parse_args()
+
+here = os.path.dirname(os.path.abspath(__file__))
+sorter = os.path.join(here, 'sort.out')
+generator = os.path.join(here, 'generator.py')
+checker = os.path.join(here, 'checker.py')
+
+
+# median of every number in the stats of the runs, nested objects included
+def median_stats(runs):
+	result = {}
+	for key, value in runs[0].items():
+		if isinstance(value, dict):
+			result[key] = median_stats([run[key] for run in runs])
+		elif isinstance(value, (int, float)):
+			result[key] = statistics.median(run[key] for run in runs)
+		else:
+			result[key] = value
+	return result
+
+
+def generate(directory, size, distribution):
+	files = []
+	for i in range(0, args.f):
+		path = os.path.join(directory, '{}-{}-{}.txt'.format(distribution, size, i))
+		count = size // args.f + (1 if i < size % args.f else 0)
+		subprocess.run([sys.executable, generator, '-f', path, '-c', str(count),
+				'-d', distribution, '-t', args.t], check=True)
+		files.append(path)
+	return files
+
+
+def run(directory, options, files):
+	stats_path = os.path.join(directory, 'stats.json')
+	command = [sorter] + shlex.split(options) + ['--type', args.t,
+		   '--stats', stats_path, str(args.l)] + files
+	# result.txt is written to the working directory
+	subprocess.run(command, cwd=directory, check=True, stdout=subprocess.DEVNULL)
+	f = open(stats_path, 'r')
+	stats = json.load(f)
+	f.close()
+	return stats
+
+
+def check(directory):
+	command = [sys.executable, checker, '-f', os.path.join(directory, 'result.txt')]
+	if args.t == 'record':
+		command.append('-r')
+	if subprocess.run(command, stdout=subprocess.DEVNULL).returncode:
+		print('Error: the result is not sorted', file=sys.stderr)
+		exit(1)
+
+
+results = []
+configurations = args.a if args.a else ['']
+with tempfile.TemporaryDirectory(prefix='sort-bench-') as directory:
+	for size in [int(s) for s in args.s.split(',')]:
+		for distribution in args.d.split(','):
+			files = generate(directory, size, distribution)
+			for options in configurations:
+				runs = [run(directory, options, files) for i in range(0, args.r)]
+				check(directory)
+				results.append({'size': size, 'distribution': distribution,
+						'files': args.f, 'options': options,
+						'runs': args.r, 'median': median_stats(runs)})
+				print('{} {} "{}": {:.0f} us'.format(distribution, size, options,
+								     results[-1]['median']['total_us']),
+				      file=sys.stderr)
+			for path in files:
+				os.remove(path)
+
+output = json.dumps(results, indent=2)
+if args.o is not None:
+	f = open(args.o, 'w')
+	f.write(output + '\n')
+	f.close()
+else:
+	print(output)
+
+if args.b is not None:
+	f = open(args.b, 'r')
+	baseline = json.load(f)
+	f.close()
+	regressions = 0
+	for result in results:
+		for old in baseline:
+			if [old[k] for k in ('size', 'distribution', 'files', 'options')] != \
+			   [result[k] for k in ('size', 'distribution', 'files', 'options')]:
+				continue
+			before, after = old['median']['total_us'], result['median']['total_us']
+			if after > before * (1 + args.x / 100):
+				regressions += 1
+				print('Regression: {} {} "{}": {:.0f} us, {:.0f} us before'.format(
+				      result['distribution'], result['size'], result['options'],
+				      after, before), file=sys.stderr)
+	if regressions:
+		exit(1)
@@ -0,0 +1,218 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "coro.h"
+
+// measures the coroutine runtime: spawning and finishing coroutines,
+// switching between them, passing items through channels between workers
+// and how late coro_sleep() wakes up
+
+#define STACK_SIZE (32 * 1024)
+
+static long long get_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sched_init(coro_sched *sched, int workers)
+{
+    coro_config config;
+    config.workers = workers;
+    config.active_limit = 0;
+    config.stack_size = STACK_SIZE;
+    config.quantum = 1000000; // nothing is preempted
+    config.use_aio = 0;
+#ifdef CORO_HOOKS
+    config.on_slice = NULL;
+#endif
+    coro_sched_init(sched, &config);
+}
+
+static void report(const char *name, long long count, long long elapsed)
+{
+    printf("%-34s %9lld in %8lld us: %6.2f M/s, %7.1f ns each\n", name, count, elapsed / 1000,
+           count * 1000.0 / elapsed, (double)elapsed / count);
+}
+
+static void* do_nothing(void *arg)
+{
+    return arg;
+}
+
+typedef struct spawner_arg
+{
+    coro_sched *sched;
+    long long count;
+} spawner_arg;
+
+// spawns and joins the coroutines in batches, so that only a batch of
+// stacks is mapped at once
+static void* spawn_and_join(void *arg)
+{
+    spawner_arg *spawner = arg;
+    coro_struct *batch[64];
+    for (long long done = 0; done < spawner->count; done += 64) {
+        int size = spawner->count - done < 64 ? spawner->count - done : 64;
+        for (int i = 0; i < size; ++i)
+            batch[i] = coro_spawn(spawner->sched, do_nothing, (void *)(intptr_t)i);
+        for (int i = 0; i < size; ++i)
+            if (coro_join(batch[i]) != (void *)(intptr_t)i) {
+                fprintf(stderr, "coro_join returned a wrong result\n");
+                exit(1);
+            }
+    }
+    return NULL;
+}
+
+static void bench_spawn(long long count)
+{
+    coro_sched sched;
+    sched_init(&sched, 1);
+    long long start = get_time_ns();
+    for (long long i = 0; i < count; ++i)
+        coro_spawn(&sched, do_nothing, NULL);
+    coro_sched_run(&sched);
+    report("spawn before run, run, finish", count, get_time_ns() - start);
+    coro_sched_destroy(&sched);
+
+    sched_init(&sched, 1);
+    spawner_arg spawner = {&sched, count};
+    start = get_time_ns();
+    coro_spawn(&sched, spawn_and_join, &spawner);
+    coro_sched_run(&sched);
+    report("spawn and join from a coroutine", count, get_time_ns() - start);
+    coro_sched_destroy(&sched);
+}
+
+static void* yield_loop(void *arg)
+{
+    long long count = *(long long *)arg;
+    for (long long i = 0; i < count; ++i)
+        coro_yield();
+    return NULL;
+}
+
+static void bench_switch(long long count)
+{
+    coro_sched sched;
+    sched_init(&sched, 1);
+    coro_spawn(&sched, yield_loop, &count);
+    coro_spawn(&sched, yield_loop, &count);
+    long long start = get_time_ns();
+    coro_sched_run(&sched);
+    report("coro_yield() switch", 2 * count, get_time_ns() - start);
+    coro_sched_destroy(&sched);
+}
+
+typedef struct channel_arg
+{
+    coro_channel channel;
+    long long count;
+    long long sum;
+} channel_arg;
+
+static void* produce(void *arg)
+{
+    channel_arg *channel = arg;
+    for (long long i = 1; i <= channel->count; ++i)
+        coro_channel_send(&channel->channel, (void *)(intptr_t)i);
+    coro_channel_close(&channel->channel);
+    return NULL;
+}
+
+static void* consume(void *arg)
+{
+    channel_arg *channel = arg;
+    void *item;
+    while (!coro_channel_recv(&channel->channel, &item))
+        channel->sum += (intptr_t)item;
+    return NULL;
+}
+
+// one producer and one consumer, on two workers they are started on
+// different threads as each worker takes one from the pending queue
+static void bench_channel(long long count, size_t capacity, int workers)
+{
+    coro_sched sched;
+    sched_init(&sched, workers);
+    channel_arg channel;
+    coro_channel_init(&channel.channel, capacity);
+    channel.count = count;
+    channel.sum = 0;
+    coro_spawn(&sched, produce, &channel);
+    coro_spawn(&sched, consume, &channel);
+    long long start = get_time_ns();
+    coro_sched_run(&sched);
+    long long elapsed = get_time_ns() - start;
+    if (channel.sum != count * (count + 1) / 2) {
+        fprintf(stderr, "The channel lost items\n");
+        exit(1);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "channel of %zu, %d worker%s", capacity, workers,
+             workers > 1 ? "s" : "");
+    report(name, count, elapsed);
+    coro_channel_destroy(&channel.channel);
+    coro_sched_destroy(&sched);
+}
+
+#define SLEEPS 20
+
+static long long total_lateness; // ns, every sleeper runs on the one worker
+
+// the first sleep is not counted, it may end while the worker is still
+// starting the other sleepers
+static void* sleep_repeatedly(void *arg)
+{
+    unsigned seed = (intptr_t)arg;
+    for (int i = 0; i <= SLEEPS; ++i) {
+        long long us = rand_r(&seed) % 1000;
+        long long start = get_time_ns();
+        coro_sleep(us);
+        long long lateness = get_time_ns() - start - us * 1000;
+        if (lateness < 0) {
+            fprintf(stderr, "coro_sleep() woke up early\n");
+            exit(1);
+        }
+        if (i)
+            total_lateness += lateness;
+    }
+    return NULL;
+}
+
+static void bench_sleep(int count)
+{
+    coro_sched sched;
+    sched_init(&sched, 1);
+    for (int i = 0; i < count; ++i)
+        coro_spawn(&sched, sleep_repeatedly, (void *)(intptr_t)i);
+    long long start = get_time_ns();
+    coro_sched_run(&sched);
+    long long elapsed = get_time_ns() - start;
+    printf("%d coroutines slept %d times up to 1 ms in %lld us, woke up %.1f us late on average\n",
+           count, SLEEPS, elapsed / 1000, total_lateness / 1000.0 / count / SLEEPS);
+    coro_sched_destroy(&sched);
+}
+
+int main(int argc, char *argv[])
+{
+    long long count = argc > 1 ? atoll(argv[1]) : 1000000;
+    if (count <= 0) {
+        fprintf(stderr, "Usage: %s [operations]\n", argv[0]);
+        return 1;
+    }
+
+    bench_spawn(count / 10);
+    bench_switch(count);
+    bench_channel(count, 1, 1);
+    bench_channel(count, 64, 1);
+    bench_channel(count / 10, 1, 2);
+    bench_channel(count, 64, 2);
+    bench_sleep(1000);
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parse.h"
+
+// compares parse MB/s of the former fmemopen() + fscanf() path with
+// the single-pass tokenizer, scalar and SIMD
+
+#define DEFAULT_COUNT 5000000
+#define BATCH 1024
+
+static long long get_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// the same text generator.py produces
+static char* generate_text(size_t count, size_t *size)
+{
+    char *text = malloc(count * 12 + 1);
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i)
+        len += sprintf(text + len, i + 1 == count ? "%d" : "%d ", rand());
+    *size = len;
+    return text;
+}
+
+// counts the numbers, then stores them: what sort_file() used to do
+static size_t parse_fscanf(char *text, size_t size, int **res)
+{
+    FILE *stream = fmemopen(text, size, "r");
+    size_t count = 0;
+    long dummy;
+    while (fscanf(stream, "%ld", &dummy) == 1)
+        ++count;
+
+    int *numbers = malloc(count * sizeof(int));
+    fseek(stream, 0, SEEK_SET);
+    for (size_t i = 0; i < count; ++i)
+        if (fscanf(stream, "%d", &numbers[i]) != 1)
+            break;
+    fclose(stream);
+
+    *res = numbers;
+    return count;
+}
+
+typedef size_t (*parse_func)(const char **, const char *, int_vector *, size_t);
+
+static size_t parse_batches(parse_func parse, char *text, size_t size, int **res)
+{
+    const char *pos = text;
+    int_vector numbers = {NULL, 0, 0};
+    int_vector_reserve(&numbers, size / 8 + 1);
+    while (parse(&pos, text + size, &numbers, BATCH) == BATCH)
+        ;
+    *res = numbers.data;
+    return numbers.size;
+}
+
+static size_t parse_scalar(char *text, size_t size, int **res)
+{
+    return parse_batches(parse_ints_scalar, text, size, res);
+}
+
+static size_t parse_best(char *text, size_t size, int **res)
+{
+    return parse_batches(parse_ints, text, size, res);
+}
+
+static int *expected;
+static size_t expected_count;
+
+static void bench(const char *name, size_t (*parse)(char *, size_t, int **),
+                  char *text, size_t size)
+{
+    int *numbers;
+    long long start = get_time_ns();
+    size_t count = parse(text, size, &numbers);
+    long long elapsed = get_time_ns() - start;
+
+    if (!expected) {
+        expected = numbers;
+        expected_count = count;
+    } else {
+        if (count != expected_count || memcmp(numbers, expected, count * sizeof(int))) {
+            fprintf(stderr, "%s: parsed numbers differ\n", name);
+            exit(1);
+        }
+        free(numbers);
+    }
+
+    printf("%-8s %zu numbers in %lld us: %.1f MB/s, %.2f ns per number\n",
+           name, count, elapsed / 1000, size * 1000.0 / elapsed, (double)elapsed / count);
+}
+
+int main(int argc, char **argv)
+{
+    size_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_COUNT;
+    size_t size;
+    char *text = generate_text(count, &size);
+    printf("%zu numbers, %zu bytes of text\n", count, size);
+
+    bench("fscanf", parse_fscanf, text, size);
+    bench("scalar", parse_scalar, text, size);
+    bench(parse_ints_impl, parse_best, text, size);
+
+    free(expected);
+    free(text);
+    return 0;
+}
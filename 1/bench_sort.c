@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sort_kernels.h"
+
+// ns per element and throughput of the sort kernels for every element type,
+// int32 is also compared against the former recursive merge sort which
+// allocated a temporary buffer in every merge; then all the kernels on
+// presorted int32 and records
+
+// the recursive sort is too slow to wait for on bigger arrays
+#define RECURSIVE_MAX_SIZE 10000000
+
+static long long get_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void merge_recursive(int *array, size_t size)
+{
+    int *p_left = array, *p_right = array + size / 2;
+    int *tmp_res = malloc(size * sizeof(int));
+    int *p_tmp = tmp_res;
+
+    while (p_left < array + size / 2 && p_right < array + size)
+        *p_tmp++ = *p_left <= *p_right ? *p_left++ : *p_right++;
+    while (p_left < array + size / 2)
+        *p_tmp++ = *p_left++;
+    while (p_right < array + size)
+        *p_tmp++ = *p_right++;
+
+    memcpy(array, tmp_res, size * sizeof(int));
+    free(tmp_res);
+}
+
+static void merge_sort_recursive(int *array, size_t size)
+{
+    if (size <= 1)
+        return;
+
+    merge_sort_recursive(array, size / 2);
+    merge_sort_recursive(array + size / 2, size - size / 2);
+    merge_recursive(array, size);
+}
+
+static void sort_recursive(int *array, int *tmp, size_t size)
+{
+    merge_sort_recursive(array, size);
+}
+
+static uint64_t random_u64()
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 4; ++i)
+        value = value << 16 ^ (unsigned int)rand();
+    return value;
+}
+
+// the presorted inputs: the keys sorted, sorted down, sorted with 1% of them
+// moved to random places, and 16 sorted parts one after another like an
+// appended log
+static const char *orders[] = {"sorted", "reverse", "nearly", "appended"};
+
+// keys are random and fit int32, the payloads keep their indices, tmp has
+// room for size records
+static void fill_presorted(sort_record *input, sort_record *tmp, size_t size, const char *order)
+{
+    size_t parts = strcmp(order, "appended") ? 1 : 16;
+    for (size_t i = 0; i < size; ++i) {
+        input[i].key = random_u64() >> 33;
+        input[i].payload = i;
+    }
+    for (size_t part = 0; part < parts; ++part) {
+        size_t begin = size * part / parts, end = size * (part + 1) / parts;
+        radix_sort_rec(input + begin, tmp, end - begin);
+    }
+    if (!strcmp(order, "reverse"))
+        for (size_t i = 0; i < size / 2; ++i) {
+            int64_t key = input[i].key;
+            input[i].key = input[size - 1 - i].key;
+            input[size - 1 - i].key = key;
+        }
+    if (!strcmp(order, "nearly"))
+        for (size_t i = 0; i < size / 100; ++i)
+            input[random_u64() % size].key = random_u64() >> 33;
+}
+
+static void print_result(const char *name, long long elapsed, size_t size, size_t elem_size)
+{
+    printf("  %-10s %8lld us, %6.2f ns per element, %7.1f MB/s\n", name, elapsed / 1000,
+           (double)elapsed / size, elapsed ? (double)size * elem_size * 1000 / elapsed : 0.0);
+}
+
+// BENCH_DEFINE(name, type, KEY) defines bench_<name>() timing a kernel of type
+// on a copy of input and checking the keys come out in order
+#define BENCH_DEFINE(name, type, KEY) \
+static void bench_##name(const char *kernel_name, void (*sort)(type *, type *, size_t), \
+                         const type *input, type *array, type *tmp, size_t size) \
+{ \
+    memcpy(array, input, size * sizeof(type)); \
+    long long start = get_time_ns(); \
+    sort(array, tmp, size); \
+    long long elapsed = get_time_ns() - start; \
+    for (size_t i = 1; i < size; ++i) { \
+        if (KEY(array[i - 1]) > KEY(array[i])) { \
+            fprintf(stderr, "%s: the array is not sorted\n", kernel_name); \
+            exit(1); \
+        } \
+    } \
+    print_result(kernel_name, elapsed, size, sizeof(type)); \
+}
+
+BENCH_DEFINE(i32, int, SORT_KEY_SELF)
+BENCH_DEFINE(i64, int64_t, SORT_KEY_SELF)
+BENCH_DEFINE(rec, sort_record, SORT_KEY_FIELD)
+
+int main(int argc, char **argv)
+{
+    size_t default_sizes[] = {100000, 10000000, 100000000};
+    int sizes_count = argc > 1 ? argc - 1 : 3;
+
+    for (int s = 0; s < sizes_count; ++s) {
+        size_t size = argc > 1 ? strtoull(argv[s + 1], NULL, 10) : default_sizes[s];
+        // the buffers fit the largest element, every type reuses them
+        sort_record *input = malloc(size * sizeof(sort_record));
+        sort_record *array = malloc(size * sizeof(sort_record));
+        sort_record *tmp = malloc(size * sizeof(sort_record));
+        // fault the pages in before timing
+        memset(array, 0, size * sizeof(sort_record));
+        memset(tmp, 0, size * sizeof(sort_record));
+        int *keys = malloc(size * sizeof(int));
+
+        for (size_t i = 0; i < size; ++i)
+            ((int64_t *)input)[i] = random_u64();
+        printf("%zu random int32:\n", size);
+        if (size <= RECURSIVE_MAX_SIZE)
+            bench_i32("recursive", sort_recursive, (int *)input, (int *)array, (int *)tmp, size);
+        bench_i32("bottom-up", merge_sort_i32, (int *)input, (int *)array, (int *)tmp, size);
+        bench_i32("radix", radix_sort_i32, (int *)input, (int *)array, (int *)tmp, size);
+        bench_i32("natural", natural_sort_i32, (int *)input, (int *)array, (int *)tmp, size);
+
+        printf("%zu random int64:\n", size);
+        bench_i64("bottom-up", merge_sort_i64, (int64_t *)input, (int64_t *)array,
+                  (int64_t *)tmp, size);
+        bench_i64("radix", radix_sort_i64, (int64_t *)input, (int64_t *)array,
+                  (int64_t *)tmp, size);
+        bench_i64("natural", natural_sort_i64, (int64_t *)input, (int64_t *)array,
+                  (int64_t *)tmp, size);
+
+        for (size_t i = 0; i < size; ++i) {
+            input[i].key = random_u64();
+            input[i].payload = i;
+        }
+        printf("%zu records of int64 key + int64 payload:\n", size);
+        bench_rec("bottom-up", merge_sort_rec, input, array, tmp, size);
+        bench_rec("radix", radix_sort_rec, input, array, tmp, size);
+        bench_rec("natural", natural_sort_rec, input, array, tmp, size);
+
+        for (size_t o = 0; o < sizeof(orders) / sizeof(orders[0]); ++o) {
+            fill_presorted(input, tmp, size, orders[o]);
+            printf("%zu %s records:\n", size, orders[o]);
+            bench_rec("bottom-up", merge_sort_rec, input, array, tmp, size);
+            bench_rec("radix", radix_sort_rec, input, array, tmp, size);
+            bench_rec("natural", natural_sort_rec, input, array, tmp, size);
+
+            for (size_t i = 0; i < size; ++i)
+                keys[i] = input[i].key;
+            printf("%zu %s int32:\n", size, orders[o]);
+            bench_i32("bottom-up", merge_sort_i32, keys, (int *)array, (int *)tmp, size);
+            bench_i32("radix", radix_sort_i32, keys, (int *)array, (int *)tmp, size);
+            bench_i32("natural", natural_sort_i32, keys, (int *)array, (int *)tmp, size);
+        }
+
+        free(keys);
+        free(input);
+        free(array);
+        free(tmp);
+    }
+    return 0;
+}
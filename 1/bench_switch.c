@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "coro_context.h"
+
+// measures coro_context_switch() by ping-ponging between main and one coroutine
+
+#define ROUND_TRIPS 10000000
+#define STACK_SIZE (64 * 1024)
+
+static coro_context main_context, coro_context_;
+
+static void ping_pong(void *arg)
+{
+    while (1)
+        coro_context_switch(&coro_context_, &main_context);
+}
+
+static long long get_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main()
+{
+    void *stack = malloc(STACK_SIZE);
+    coro_context_init(&coro_context_, stack, STACK_SIZE, ping_pong, NULL);
+
+    long long start = get_time_ns();
+    for (int i = 0; i < ROUND_TRIPS; ++i)
+        coro_context_switch(&main_context, &coro_context_);
+    long long elapsed = get_time_ns() - start;
+
+    long long switches = 2LL * ROUND_TRIPS;
+    printf("%-12s %lld switches in %lld us: %.1f M switches/s, %.1f ns per switch\n",
+           CORO_CONTEXT_BACKEND, switches, elapsed / 1000,
+           switches * 1000.0 / elapsed, (double)elapsed / switches);
+
+    free(stack);
+    return 0;
+}
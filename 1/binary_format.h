@@ -0,0 +1,71 @@
+#ifndef SORT_BINARY_FORMAT_H
+#define SORT_BINARY_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Binary files of numbers: a 16-byte header followed by count raw
+// little-endian elements of elem_size bytes, a 16-byte element is a record
+// of an int64 key and an int64 payload. The sorter tells them from
+// text by the magic, generator.py and checker.py convert between the two.
+#define BINARY_MAGIC "SRTB"
+#define BINARY_VERSION 1
+
+typedef struct binary_header
+{
+    char magic[4];
+    uint8_t version;
+    uint8_t elem_size; // 4, 8 or 16
+    uint8_t reserved[2];
+    uint64_t count;    // little-endian
+} binary_header;
+
+_Static_assert(sizeof(binary_header) == 16, "the header is 16 bytes on disk");
+
+static inline uint64_t binary_le64(uint64_t value)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap64(value);
+#else
+    return value;
+#endif
+}
+
+static inline void binary_header_init(binary_header *header, int elem_size, uint64_t count)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, BINARY_MAGIC, sizeof(header->magic));
+    header->version = BINARY_VERSION;
+    header->elem_size = elem_size;
+    header->count = binary_le64(count);
+}
+
+// whether data of size bytes starts with a binary header
+static inline int binary_header_check(const void *data, size_t size)
+{
+    return size >= sizeof(binary_header) && !memcmp(data, BINARY_MAGIC, 4);
+}
+
+// converts count elements of elem_size bytes read from a binary file to the
+// host byte order and back, records are swapped field by field
+static inline void binary_swap_elems(void *data, size_t count, int elem_size)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    if (elem_size == 4) {
+        uint32_t *words = data;
+        for (size_t i = 0; i < count; ++i)
+            words[i] = __builtin_bswap32(words[i]);
+    } else {
+        uint64_t *words = data;
+        for (size_t i = 0; i < count * elem_size / 8; ++i)
+            words[i] = __builtin_bswap64(words[i]);
+    }
+#else
+    (void)data;
+    (void)count;
+    (void)elem_size;
+#endif
+}
+
+#endif
@@ -1,5 +1,8 @@
 import random
 import argparse
+import struct
+import sys
+from array import array
 
 maxint = 1 << 31
 
@@ -7,23 +10,88 @@ parser = argparse.ArgumentParser(description = "Check that a file contains "\
 					       "not decreasing sequence of "\
 					       "numbers")
 parser.add_argument('-f', type=str, required=True, help="file name")
+parser.add_argument('-t', type=str, help="also write the numbers to this "\
+					 "file as text, e.g. to convert "\
+					 "a binary file")
+parser.add_argument('-r', action='store_true', help="the numbers are records "\
+						    "of a key and a payload, "\
+						    "only the keys are checked")
+parser.add_argument('-i', type=str, nargs='+', help="input files, the file "\
+						     "must hold exactly their "\
+						     "elements")
 args = parser.parse_args()
 
 
-f = open(args.f, 'r')
-data = f.read()
-f.close()
+# the numbers of a text or a binary file and whether they are records
+def read_numbers(name):
+	f = open(name, 'rb')
+	raw = f.read()
+	f.close()
 
-data = data.split()
-prev_number = -(1 << 31 - 1)
-for i in range(0, len(data)):
+	# binary files start with "SRTB", see generator.py -b
+	if raw[:4] != b'SRTB':
+		return raw.decode().split(), False
+
+	version, elem_size, count = struct.unpack_from('<BB2xQ', raw, 4)
+	if version != 1:
+		print('Error: {} has binary format version {}, not 1'.format(name, version))
+		exit(1)
+	data = array('i' if elem_size == 4 else 'q')
+	data.frombytes(raw[16:16 + count * elem_size])
+	if sys.byteorder == 'big':
+		data.byteswap()
+	if len(data) * data.itemsize != count * elem_size:
+		print('Error: {} is truncated'.format(name))
+		exit(1)
+	# 16-byte elements are records
+	return data, elem_size == 16
+
+# the elements in order, (key, payload) pairs for records
+def elements(data, records):
+	numbers = []
+	for v in data:
+		try:
+			numbers.append(int(v))
+		except ValueError:
+			continue
+	if records:
+		return list(zip(numbers[0::2], numbers[1::2]))
+	return numbers
+
+
+data, records = read_numbers(args.f)
+if records:
+	args.r = True
+
+prev_number = -(1 << 63)
+for i in range(0, len(data), 2 if args.r else 1):
 	try:
 		v = int(data[i])
-		if v < prev_number:
-			print('Error on numbers {} {}'.format(prev_number, v))
-			exit(1)
-		prev_number = v
-	except:
-		pass
+	except ValueError:
+		continue
+	if v < prev_number:
+		print('Error on numbers {} {}'.format(prev_number, v))
+		exit(1)
+	prev_number = v
+
+if args.i is not None:
+	expected = []
+	for name in args.i:
+		input_data, input_records = read_numbers(name)
+		expected += elements(input_data, args.r or input_records)
+	expected.sort()
+	result = sorted(elements(data, args.r))
+	if len(result) != len(expected):
+		print('Error: {} elements instead of the {} of the '\
+		      'inputs'.format(len(result), len(expected)))
+		exit(1)
+	if result != expected:
+		print('Error: the elements differ from the ones of the inputs')
+		exit(1)
+
+if args.t is not None:
+	f = open(args.t, 'w')
+	f.write(' '.join(str(v) for v in data))
+	f.close()
 
 print('All is ok')
@@ -0,0 +1,897 @@
+// ppoll()
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "coro.h"
+
+__thread int coro_quantum_checks_left;
+static __thread coro_worker *curr_worker;
+static __thread long long quantum_deadline; // us, end of the current coroutine's quantum
+
+// POSIX AIO can't be waited for together with the event fd, a worker parked
+// on AIO requests looks at its inbox this often, us
+#define AIO_POLL_INTERVAL 1000
+
+// the overflow handler can't run on the overflowed stack
+#define SIGNAL_STACK_SIZE (64 * 1024)
+
+static long long get_time_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// reallocates items to hold capacity elements of size bytes, exits on failure
+static void* grow_array(void *items, size_t capacity, size_t size)
+{
+    items = realloc(items, capacity * size);
+    if (!items) {
+        perror("coroutines");
+        exit(1);
+    }
+    return items;
+}
+
+static void coro_queue_init(coro_queue *queue)
+{
+    queue->items = NULL;
+    queue->head = queue->count = queue->capacity = 0;
+}
+
+static void coro_queue_push(coro_queue *queue, coro_struct *coro)
+{
+    if (queue->count == queue->capacity) {
+        // unwraps the ring into the new buffer
+        int capacity = queue->capacity ? queue->capacity * 2 : 16;
+        coro_struct **items = grow_array(NULL, capacity, sizeof(coro_struct *));
+        for (int i = 0; i < queue->count; ++i)
+            items[i] = queue->items[(queue->head + i) % queue->capacity];
+        free(queue->items);
+        queue->items = items;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+    queue->items[(queue->head + queue->count++) % queue->capacity] = coro;
+}
+
+static coro_struct* coro_queue_pop_head(coro_queue *queue)
+{
+    if (!queue->count)
+        return NULL;
+    coro_struct *coro = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    return coro;
+}
+
+static coro_struct* coro_queue_pop_tail(coro_queue *queue)
+{
+    if (!queue->count)
+        return NULL;
+    return queue->items[(queue->head + --queue->count) % queue->capacity];
+}
+
+static void timer_push(coro_worker *w, long long deadline, coro_struct *coro)
+{
+    if (w->timer_count == w->timer_capacity) {
+        w->timer_capacity = w->timer_capacity ? w->timer_capacity * 2 : 16;
+        w->timers = grow_array(w->timers, w->timer_capacity, sizeof(coro_timer));
+    }
+    int i = w->timer_count++;
+    while (i > 0 && w->timers[(i - 1) / 2].deadline > deadline) {
+        w->timers[i] = w->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    w->timers[i].deadline = deadline;
+    w->timers[i].coro = coro;
+}
+
+// removes the timer with the earliest deadline
+static coro_struct* timer_pop(coro_worker *w)
+{
+    coro_struct *coro = w->timers[0].coro;
+    coro_timer last = w->timers[--w->timer_count];
+    int i = 0;
+    while (2 * i + 1 < w->timer_count) {
+        int child = 2 * i + 1;
+        if (child + 1 < w->timer_count && w->timers[child + 1].deadline < w->timers[child].deadline)
+            child++;
+        if (last.deadline <= w->timers[child].deadline)
+            break;
+        w->timers[i] = w->timers[child];
+        i = child;
+    }
+    w->timers[i] = last;
+    return coro;
+}
+
+static void coro_entry(void *arg);
+
+// wakes w if it is blocked in worker_idle(), w->lock must not be held
+static void worker_notify(coro_worker *w)
+{
+    pthread_mutex_lock(&w->lock);
+    int is_idle = w->is_idle;
+    w->is_idle = 0;
+    pthread_mutex_unlock(&w->lock);
+    if (is_idle) {
+        uint64_t one = 1;
+        // can't fail short of the counter overflowing, which is a wakeup too
+        (void)!write(w->event_fd, &one, sizeof(one));
+    }
+}
+
+// makes a parked coroutine runnable again, may be called from any thread
+static void coro_wake(coro_struct *coro)
+{
+    coro_worker *w = coro->worker;
+    if (w == curr_worker) {
+        coro_queue_push(&w->runnable, coro);
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    coro_queue_push(&w->inbox, coro);
+    pthread_mutex_unlock(&w->lock);
+    worker_notify(w);
+}
+
+static int worker_can_start(const coro_worker *w)
+{
+    int limit = w->sched->config.active_limit;
+    return !limit || w->active_count < limit;
+}
+
+// takes a not started coroutine from the tail of another worker's queue
+static coro_struct* worker_steal(coro_worker *w)
+{
+    coro_sched *sched = w->sched;
+    for (int i = 1; i < sched->workers_count; ++i) {
+        coro_worker *victim = &sched->workers[(w->id + i) % sched->workers_count];
+        pthread_mutex_lock(&victim->lock);
+        coro_struct *coro = coro_queue_pop_tail(&victim->pending);
+        pthread_mutex_unlock(&victim->lock);
+        if (coro) {
+            w->stolen_count++;
+            return coro;
+        }
+    }
+    return NULL;
+}
+
+// whether another worker has a coroutine to steal
+static int worker_may_steal(coro_worker *w)
+{
+    coro_sched *sched = w->sched;
+    for (int i = 1; i < sched->workers_count; ++i) {
+        coro_worker *victim = &sched->workers[(w->id + i) % sched->workers_count];
+        pthread_mutex_lock(&victim->lock);
+        int count = victim->pending.count;
+        pthread_mutex_unlock(&victim->lock);
+        if (count)
+            return 1;
+    }
+    return 0;
+}
+
+// moves coroutines whose requests have completed to the run queue
+static void worker_reap_io(coro_worker *w)
+{
+    if (!w->has_ring) {
+        // the AIO wait list is unordered, a completed request is replaced by the last one
+        for (int i = 0; i < w->io_waiting;) {
+            struct aiocb *control_block = w->aio_waiting[i];
+            if (aio_error(control_block) == EINPROGRESS) {
+                ++i;
+                continue;
+            }
+            w->aio_waiting[i] = w->aio_waiting[--w->io_waiting];
+            coro_queue_push(&w->runnable, control_block->aio_sigevent.sigev_value.sival_ptr);
+        }
+        return;
+    }
+
+    void *user_data;
+    int res;
+    while (w->io_in_flight && io_ring_peek(&w->ring, &user_data, &res)) {
+        io_request *request = user_data;
+        request->result = res;
+        request->is_done = 1;
+        w->io_in_flight--;
+        if (request->is_waited) {
+            w->io_waiting--;
+            coro_queue_push(&w->runnable, request->coro);
+        }
+    }
+}
+
+// moves the coroutines whose requests have completed or whose timers have
+// expired to the run queue
+static void worker_collect(coro_worker *w)
+{
+    worker_reap_io(w);
+    if (w->timer_count) {
+        long long now = get_time_us();
+        while (w->timer_count && w->timers[0].deadline <= now)
+            coro_queue_push(&w->runnable, timer_pop(w));
+    }
+}
+
+// blocks until a request completes, a coroutine is woken or spawned by
+// another thread, the earliest timer expires or the last coroutine finishes
+static void worker_idle(coro_worker *w)
+{
+    struct timespec timeout, *timeout_ptr = NULL;
+    long long wait_time = -1; // us
+    if (w->timer_count) {
+        wait_time = w->timers[0].deadline - get_time_us();
+        if (wait_time <= 0)
+            return;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    int has_work = w->inbox.count > 0;
+    w->is_idle = !has_work;
+    pthread_mutex_unlock(&w->lock);
+    if (has_work)
+        return;
+    // whoever spawns or finishes a coroutine after these checks sees is_idle
+    if (!__atomic_load_n(&w->sched->live_count, __ATOMIC_SEQ_CST) ||
+        (worker_can_start(w) && worker_may_steal(w))) {
+        pthread_mutex_lock(&w->lock);
+        w->is_idle = 0;
+        pthread_mutex_unlock(&w->lock);
+        return;
+    }
+
+    if (!w->has_ring && w->io_waiting) {
+        if (wait_time < 0 || wait_time > AIO_POLL_INTERVAL)
+            wait_time = AIO_POLL_INTERVAL;
+        timeout.tv_sec = wait_time / 1000000;
+        timeout.tv_nsec = wait_time % 1000000 * 1000;
+        if (aio_suspend((const struct aiocb * const *)w->aio_waiting, w->io_waiting,
+                        &timeout) < 0 && errno != EAGAIN && errno != EINTR) {
+            perror("aio_suspend");
+            exit(1);
+        }
+    } else {
+        struct pollfd fds[2];
+        fds[0].fd = w->event_fd;
+        fds[0].events = POLLIN;
+        // the ring polls readable while it has completions
+        fds[1].fd = w->has_ring ? w->ring.fd : -1;
+        fds[1].events = POLLIN;
+        if (wait_time >= 0) {
+            timeout.tv_sec = wait_time / 1000000;
+            timeout.tv_nsec = wait_time % 1000000 * 1000;
+            timeout_ptr = &timeout;
+        }
+        if (ppoll(fds, 2, timeout_ptr, NULL) < 0 && errno != EINTR) {
+            perror("ppoll");
+            exit(1);
+        }
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->is_idle = 0;
+    pthread_mutex_unlock(&w->lock);
+    uint64_t count;
+    (void)!read(w->event_fd, &count, sizeof(count));
+}
+
+// takes a stack for coro and prepares it to run on w
+static void worker_start(coro_worker *w, coro_struct *coro)
+{
+    // only running coroutines hold a stack, the one of a finished
+    // coroutine is reused by the next
+    coro->stack = coro_stack_alloc(&w->stacks);
+    if (!coro->stack) {
+        perror("coroutine stack");
+        exit(1);
+    }
+    coro_context_init(&coro->context, coro->stack, w->stacks.stack_size, coro_entry, coro);
+    coro->worker = w;
+    w->active_count++;
+    w->started_count++;
+}
+
+// chooses the coroutine to run next on the worker, NULL once every
+// coroutine of the scheduler has finished
+static coro_struct* worker_pick(coro_worker *w)
+{
+    while (1) {
+        int can_start = worker_can_start(w);
+        pthread_mutex_lock(&w->lock);
+        coro_struct *coro = can_start ? coro_queue_pop_head(&w->pending) : NULL;
+        coro_struct *woken;
+        while ((woken = coro_queue_pop_head(&w->inbox)))
+            coro_queue_push(&w->runnable, woken);
+        pthread_mutex_unlock(&w->lock);
+        if (!coro && can_start)
+            coro = worker_steal(w);
+        if (coro) {
+            worker_start(w, coro);
+            return coro;
+        }
+
+        worker_collect(w);
+        coro = coro_queue_pop_head(&w->runnable);
+        if (coro)
+            return coro;
+        if (!w->active_count && !__atomic_load_n(&w->sched->live_count, __ATOMIC_SEQ_CST))
+            return NULL;
+        // everything is parked, sleep until something changes, which may
+        // be the completion of a request no coroutine waits for yet
+        worker_idle(w);
+    }
+}
+
+// stops accounting CPU time of the running coroutine, reason tells the slice
+// hook why the slice ended
+static void coro_suspend_accounting(coro_worker *w, coro_struct *coro, long long now,
+                                    const char *reason)
+{
+    coro->total_time += now - coro->last_timestamp;
+    w->busy_time += now - coro->last_timestamp;
+#ifdef CORO_HOOKS
+    const coro_config *config = &w->sched->config;
+    if (config->on_slice)
+        config->on_slice(config->hook_arg, w->id, coro->id, reason,
+                         coro->last_timestamp, now - coro->last_timestamp);
+#endif
+}
+
+// makes coro current on the worker, starts its quantum and switches to it
+static void worker_switch_to(coro_worker *w, coro_context *from, coro_struct *coro)
+{
+    long long now = get_time_us();
+    w->current = coro;
+    coro->last_timestamp = now;
+    quantum_deadline = now + w->sched->config.quantum;
+    coro_quantum_checks_left = CORO_QUANTUM_CHECK_PERIOD;
+    if (from != &coro->context)
+        coro_context_switch(from, &coro->context);
+}
+
+coro_struct* coro_current()
+{
+    return curr_worker ? curr_worker->current : NULL;
+}
+
+long long coro_run_time()
+{
+    coro_struct *coro = curr_worker->current;
+    return coro->total_time + get_time_us() - coro->last_timestamp;
+}
+
+void coro_yield()
+{
+    coro_worker *w = curr_worker;
+    coro_struct *coro = w->current;
+
+    coro_queue_push(&w->runnable, coro);
+    coro_struct *next = worker_pick(w);
+    if (next == coro) { // the only runnable coroutine, give it a new quantum
+        if (w->sched->workers_count > 1)
+            sched_yield(); // let other workers and AIO threads use the core
+        quantum_deadline = get_time_us() + w->sched->config.quantum;
+        coro_quantum_checks_left = CORO_QUANTUM_CHECK_PERIOD;
+        return;
+    }
+
+    coro_suspend_accounting(w, coro, get_time_us(), "quantum");
+    coro->switch_count++;
+    worker_switch_to(w, &coro->context, next);
+}
+
+// suspends the running coroutine without queueing it, it runs again once
+// something makes it runnable, returns whether another coroutine ran meanwhile
+static int coro_park(const char *reason)
+{
+    coro_worker *w = curr_worker;
+    coro_struct *coro = w->current;
+
+    coro_suspend_accounting(w, coro, get_time_us(), reason);
+    coro_struct *next = worker_pick(w); // never NULL, coro is active
+    int switched = next != coro;
+    if (switched)
+        coro->switch_count++;
+    worker_switch_to(w, &coro->context, next);
+    return switched;
+}
+
+// parks the running coroutine until its request completes, a POSIX AIO
+// request has to be given as control_block
+static void coro_wait_io(struct aiocb *control_block)
+{
+    coro_worker *w = curr_worker;
+    coro_struct *coro = w->current;
+
+    if (control_block) {
+        if (w->io_waiting == w->aio_capacity) {
+            w->aio_capacity = w->aio_capacity ? w->aio_capacity * 2 : 16;
+            w->aio_waiting = grow_array(w->aio_waiting, w->aio_capacity, sizeof(struct aiocb *));
+        }
+        control_block->aio_sigevent.sigev_value.sival_ptr = coro;
+        w->aio_waiting[w->io_waiting] = control_block;
+    }
+    w->io_waiting++;
+    if (coro_park("io"))
+        coro->io_switch_count++;
+}
+
+void coro_sleep(long long us)
+{
+    coro_worker *w = curr_worker;
+    // the clock is truncated to us, the deadline is rounded up
+    timer_push(w, get_time_us() + us + 1, w->current);
+    coro_park("sleep");
+}
+
+void* coro_join(coro_struct *coro)
+{
+    coro_struct *self = curr_worker->current;
+    pthread_mutex_lock(&coro->lock);
+    if (coro->is_finished) {
+        pthread_mutex_unlock(&coro->lock);
+        return coro->result;
+    }
+    self->wait_next = coro->joiners;
+    coro->joiners = self;
+    pthread_mutex_unlock(&coro->lock);
+    coro_park("join");
+    return coro->result;
+}
+
+void coro_check_quantum_slow()
+{
+    coro_quantum_checks_left = CORO_QUANTUM_CHECK_PERIOD;
+    if (curr_worker && curr_worker->current && get_time_us() >= quantum_deadline)
+        coro_yield();
+}
+
+void coro_io_start(io_request *request, int fd, void *buf, size_t count, off_t offset,
+                   int is_write)
+{
+    coro_worker *w = curr_worker;
+    request->coro = w->current;
+    request->is_done = request->is_waited = 0;
+    if (w->has_ring) {
+        int err = is_write ? io_ring_write(&w->ring, fd, buf, count, offset, request) :
+                             io_ring_read(&w->ring, fd, buf, count, offset, request);
+        if (err < 0) {
+            request->result = -errno;
+            request->is_done = 1;
+        } else {
+            w->io_in_flight++;
+        }
+        return;
+    }
+
+    struct aiocb *control_block = &request->control_block;
+    memset(control_block, 0, sizeof(*control_block));
+    control_block->aio_fildes = fd;
+    control_block->aio_buf = buf;
+    control_block->aio_nbytes = count;
+    control_block->aio_offset = offset;
+    control_block->aio_sigevent.sigev_notify = SIGEV_NONE;
+    if ((is_write ? aio_write(control_block) : aio_read(control_block)) < 0) {
+        request->result = -errno;
+        request->is_done = 1;
+    }
+}
+
+// with io_uring the coroutine is parked until the request completes,
+// a POSIX AIO request is polled between the other coroutines' slices
+ssize_t coro_io_wait(io_request *request)
+{
+    coro_worker *w = curr_worker;
+    long long start = get_time_us();
+    if (w->has_ring) {
+        worker_reap_io(w);
+        if (!request->is_done) {
+            request->is_waited = 1;
+            coro_wait_io(NULL);
+        }
+    } else if (!request->is_done) {
+        // the control block lives on the stack of the parked coroutine
+        if (aio_error(&request->control_block) == EINPROGRESS)
+            coro_wait_io(&request->control_block);
+        int error = aio_error(&request->control_block);
+        ssize_t bytes = aio_return(&request->control_block);
+        request->result = error ? -error : bytes;
+        request->is_done = 1;
+    }
+    w->current->io_wait_time += get_time_us() - start;
+
+    if (request->result < 0) {
+        errno = -request->result;
+        return -1;
+    }
+    return request->result;
+}
+
+ssize_t coro_io(int fd, void *buf, size_t count, off_t offset, int is_write)
+{
+    io_request request;
+    coro_io_start(&request, fd, buf, count, offset, is_write);
+    return coro_io_wait(&request);
+}
+
+static void wait_list_push(coro_struct **head, coro_struct **tail, coro_struct *coro)
+{
+    coro->wait_next = NULL;
+    if (*tail)
+        (*tail)->wait_next = coro;
+    else
+        *head = coro;
+    *tail = coro;
+}
+
+static coro_struct* wait_list_pop(coro_struct **head, coro_struct **tail)
+{
+    coro_struct *coro = *head;
+    if (coro) {
+        *head = coro->wait_next;
+        if (!*head)
+            *tail = NULL;
+    }
+    return coro;
+}
+
+void coro_channel_init(coro_channel *channel, size_t capacity)
+{
+    pthread_mutex_init(&channel->lock, NULL);
+    channel->items = grow_array(NULL, capacity, sizeof(void *));
+    channel->head = channel->count = 0;
+    channel->capacity = capacity;
+    channel->is_closed = 0;
+    channel->senders = channel->senders_tail = NULL;
+    channel->receivers = channel->receivers_tail = NULL;
+}
+
+void coro_channel_destroy(coro_channel *channel)
+{
+    pthread_mutex_destroy(&channel->lock);
+    free(channel->items);
+}
+
+// a woken coroutine takes the lock again and checks, so another one may
+// have taken the slot or the item it was woken for in between
+int coro_channel_send(coro_channel *channel, void *item)
+{
+    pthread_mutex_lock(&channel->lock);
+    while (channel->count == channel->capacity && !channel->is_closed) {
+        wait_list_push(&channel->senders, &channel->senders_tail, curr_worker->current);
+        pthread_mutex_unlock(&channel->lock);
+        coro_park("send");
+        pthread_mutex_lock(&channel->lock);
+    }
+    if (channel->is_closed) {
+        pthread_mutex_unlock(&channel->lock);
+        return -1;
+    }
+    channel->items[(channel->head + channel->count++) % channel->capacity] = item;
+    coro_struct *receiver = wait_list_pop(&channel->receivers, &channel->receivers_tail);
+    pthread_mutex_unlock(&channel->lock);
+    if (receiver)
+        coro_wake(receiver);
+    return 0;
+}
+
+int coro_channel_recv(coro_channel *channel, void **item)
+{
+    pthread_mutex_lock(&channel->lock);
+    while (!channel->count && !channel->is_closed) {
+        wait_list_push(&channel->receivers, &channel->receivers_tail, curr_worker->current);
+        pthread_mutex_unlock(&channel->lock);
+        coro_park("receive");
+        pthread_mutex_lock(&channel->lock);
+    }
+    if (!channel->count) {
+        pthread_mutex_unlock(&channel->lock);
+        return -1;
+    }
+    *item = channel->items[channel->head];
+    channel->head = (channel->head + 1) % channel->capacity;
+    channel->count--;
+    coro_struct *sender = wait_list_pop(&channel->senders, &channel->senders_tail);
+    pthread_mutex_unlock(&channel->lock);
+    if (sender)
+        coro_wake(sender);
+    return 0;
+}
+
+// wakes every coroutine of the list, the next one is read before its
+// predecessor runs again and links itself elsewhere
+static void wake_list(coro_struct *coro)
+{
+    while (coro) {
+        coro_struct *next = coro->wait_next;
+        coro_wake(coro);
+        coro = next;
+    }
+}
+
+void coro_channel_close(coro_channel *channel)
+{
+    pthread_mutex_lock(&channel->lock);
+    channel->is_closed = 1;
+    coro_struct *senders = channel->senders, *receivers = channel->receivers;
+    channel->senders = channel->senders_tail = NULL;
+    channel->receivers = channel->receivers_tail = NULL;
+    pthread_mutex_unlock(&channel->lock);
+    wake_list(senders);
+    wake_list(receivers);
+}
+
+void coro_barrier_init(coro_barrier *barrier, int count)
+{
+    pthread_mutex_init(&barrier->lock, NULL);
+    barrier->count = count;
+    barrier->arrived = 0;
+    barrier->waiters = NULL;
+}
+
+void coro_barrier_destroy(coro_barrier *barrier)
+{
+    pthread_mutex_destroy(&barrier->lock);
+}
+
+int coro_barrier_wait(coro_barrier *barrier)
+{
+    pthread_mutex_lock(&barrier->lock);
+    if (++barrier->arrived == barrier->count) {
+        coro_struct *waiters = barrier->waiters;
+        barrier->arrived = 0;
+        barrier->waiters = NULL;
+        pthread_mutex_unlock(&barrier->lock);
+        wake_list(waiters);
+        return 1;
+    }
+    coro_struct *self = curr_worker->current;
+    self->wait_next = barrier->waiters;
+    barrier->waiters = self;
+    pthread_mutex_unlock(&barrier->lock);
+    coro_park("barrier");
+    return 0;
+}
+
+// body of every coroutine
+static void coro_entry(void *arg)
+{
+    coro_struct *coro = arg;
+    coro->result = coro->func(coro->arg);
+
+    coro_worker *w = curr_worker;
+    coro_sched *sched = w->sched;
+    coro_suspend_accounting(w, coro, get_time_us(), "finished");
+    w->active_count--;
+    pthread_mutex_lock(&coro->lock);
+    coro->is_finished = 1;
+    coro_struct *joiners = coro->joiners;
+    coro->joiners = NULL;
+    pthread_mutex_unlock(&coro->lock);
+    wake_list(joiners);
+    // the workers waiting for work to steal exit once there is none left
+    if (!__atomic_sub_fetch(&sched->live_count, 1, __ATOMIC_SEQ_CST))
+        for (int i = 0; i < sched->workers_count; ++i)
+            if (&sched->workers[i] != w)
+                worker_notify(&sched->workers[i]);
+
+    // never resumed again, the stack stays in use until the switch,
+    // but only the worker itself takes stacks from its pool
+    coro_struct *next = worker_pick(w);
+    coro_stack_free(&w->stacks, coro->stack);
+    if (next)
+        worker_switch_to(w, &coro->context, next);
+    else
+        coro_context_switch(&coro->context, &w->sched_context);
+}
+
+coro_struct* coro_spawn(coro_sched *sched, void *(*func)(void *), void *arg)
+{
+    coro_struct *coro = grow_array(NULL, 1, sizeof(coro_struct));
+    coro->stack = NULL;
+    coro->func = func;
+    coro->arg = arg;
+    coro->result = NULL;
+    coro->sched = sched;
+    coro->worker = NULL;
+    coro->last_timestamp = 0;
+    coro->total_time = 0;
+    coro->switch_count = 0;
+    coro->io_switch_count = 0;
+    coro->io_wait_time = 0;
+    pthread_mutex_init(&coro->lock, NULL);
+    coro->is_finished = 0;
+    coro->joiners = coro->wait_next = NULL;
+
+    coro_worker *w = curr_worker;
+    pthread_mutex_lock(&sched->lock);
+    coro->id = sched->spawned_count++;
+    coro->all_next = sched->all;
+    sched->all = coro;
+    // a coroutine spawned by a coroutine is queued on its worker, the others
+    // are distributed round-robin, idle workers steal the rest
+    if (!w || w->sched != sched)
+        w = &sched->workers[sched->next_worker++ % sched->workers_count];
+    pthread_mutex_unlock(&sched->lock);
+    __atomic_add_fetch(&sched->live_count, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&w->lock);
+    coro_queue_push(&w->pending, coro);
+    pthread_mutex_unlock(&w->lock);
+    if (w == curr_worker) {
+        for (int i = 1; i < sched->workers_count; ++i) {
+            coro_worker *thief = &sched->workers[(w->id + i) % sched->workers_count];
+            pthread_mutex_lock(&thief->lock);
+            int is_idle = thief->is_idle;
+            pthread_mutex_unlock(&thief->lock);
+            if (is_idle) {
+                worker_notify(thief);
+                break;
+            }
+        }
+    }
+    return coro;
+}
+
+// reports an overflow of a coroutine stack, the fault itself is left
+// to the default action
+static void on_fault(int sig, siginfo_t *info, void *ucontext)
+{
+    coro_worker *w = curr_worker;
+    if (w && w->current && coro_stack_is_guard(&w->stacks, w->current->stack, info->si_addr)) {
+        static const char message[] = "Coroutine stack overflow, try a bigger --stack-size\n";
+        (void)!write(STDERR_FILENO, message, sizeof(message) - 1);
+    }
+    // the faulting instruction runs again after return and kills the process
+    signal(sig, SIG_DFL);
+}
+
+static void install_fault_handler()
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_fault;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+    sigaction(SIGBUS, &action, NULL);
+}
+
+// gives the calling thread an alternate stack for the fault handler
+static void* set_signal_stack()
+{
+    stack_t ss;
+    ss.ss_sp = malloc(SIGNAL_STACK_SIZE);
+    ss.ss_size = SIGNAL_STACK_SIZE;
+    ss.ss_flags = 0;
+    if (!ss.ss_sp || sigaltstack(&ss, NULL) < 0) {
+        perror("sigaltstack");
+        exit(1);
+    }
+    return ss.ss_sp;
+}
+
+static void unset_signal_stack(void *stack)
+{
+    stack_t ss;
+    memset(&ss, 0, sizeof(ss));
+    ss.ss_flags = SS_DISABLE;
+    sigaltstack(&ss, NULL);
+    free(stack);
+}
+
+// scheduler loop of a worker, gets control back only when the worker
+// has no runnable coroutines left
+static void* worker_run(void *arg)
+{
+    coro_worker *w = arg;
+    const coro_config *config = &w->sched->config;
+    curr_worker = w;
+    w->signal_stack = set_signal_stack();
+
+    // a coroutine has at most one request in flight
+    int limit = config->active_limit;
+    unsigned ring_entries = limit && limit < 4096 ? limit : 4096;
+    w->has_ring = !config->use_aio && io_ring_init(&w->ring, ring_entries) == 0;
+
+    coro_struct *coro;
+    while ((coro = worker_pick(w)))
+        worker_switch_to(w, &w->sched_context, coro);
+
+    if (w->has_ring)
+        io_ring_destroy(&w->ring);
+    unset_signal_stack(w->signal_stack);
+    curr_worker = NULL;
+    return NULL;
+}
+
+void coro_sched_init(coro_sched *sched, const coro_config *config)
+{
+    sched->config = *config;
+    sched->workers_count = config->workers;
+    sched->workers = grow_array(NULL, config->workers, sizeof(coro_worker));
+    sched->next_worker = 0;
+    pthread_mutex_init(&sched->lock, NULL);
+    sched->all = NULL;
+    sched->spawned_count = sched->live_count = 0;
+
+    for (int i = 0; i < sched->workers_count; ++i) {
+        coro_worker *w = &sched->workers[i];
+        w->id = i;
+        w->sched = sched;
+        pthread_mutex_init(&w->lock, NULL);
+        coro_queue_init(&w->pending);
+        coro_queue_init(&w->inbox);
+        coro_queue_init(&w->runnable);
+        w->is_idle = 0;
+        w->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (w->event_fd < 0) {
+            perror("eventfd");
+            exit(1);
+        }
+        w->active_count = 0;
+        w->current = NULL;
+        w->has_ring = 0;
+        w->io_waiting = w->io_in_flight = 0;
+        w->aio_waiting = NULL;
+        w->aio_capacity = 0;
+        w->timers = NULL;
+        w->timer_count = w->timer_capacity = 0;
+        coro_stack_pool_init(&w->stacks, config->stack_size);
+        w->busy_time = 0;
+        w->started_count = w->stolen_count = 0;
+    }
+}
+
+void coro_sched_run(coro_sched *sched)
+{
+    install_fault_handler();
+    for (int i = 1; i < sched->workers_count; ++i) {
+        int err = pthread_create(&sched->workers[i].thread, NULL, worker_run, &sched->workers[i]);
+        if (err) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+    worker_run(&sched->workers[0]);
+    for (int i = 1; i < sched->workers_count; ++i)
+        pthread_join(sched->workers[i].thread, NULL);
+}
+
+void coro_sched_destroy(coro_sched *sched)
+{
+    while (sched->all) {
+        coro_struct *next = sched->all->all_next;
+        pthread_mutex_destroy(&sched->all->lock);
+        free(sched->all);
+        sched->all = next;
+    }
+    for (int i = 0; i < sched->workers_count; ++i) {
+        coro_worker *w = &sched->workers[i];
+        coro_stack_pool_destroy(&w->stacks);
+        pthread_mutex_destroy(&w->lock);
+        close(w->event_fd);
+        free(w->pending.items);
+        free(w->inbox.items);
+        free(w->runnable.items);
+        free(w->aio_waiting);
+        free(w->timers);
+    }
+    free(sched->workers);
+    pthread_mutex_destroy(&sched->lock);
+}
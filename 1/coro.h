@@ -0,0 +1,221 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include <aio.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "coro_context.h"
+#include "coro_stack.h"
+#include "io_ring.h"
+
+// Stackful coroutines scheduled M:N on the threads of a coro_sched. Every
+// worker thread interleaves its started coroutines and gives each a quantum
+// of CPU before a switch. A started coroutine never leaves its worker, only
+// not yet started ones are stolen by idle workers, so thread-local state of
+// a worker stays valid across switches. Coroutines block on their reads and
+// writes, on channels, on each other with coro_join() and on coro_sleep()
+// without blocking the thread.
+
+typedef struct coro_worker coro_worker;
+typedef struct coro_sched coro_sched;
+
+typedef struct coro_struct
+{
+    coro_context context;
+    void *stack;              // taken from the worker's pool when the coroutine starts
+    void *(*func)(void *);
+    void *arg;
+    void *result;             // what func returned
+    coro_sched *sched;
+    coro_worker *worker;      // thread the coroutine was started on, NULL until then
+    int id;                   // in the order of coro_spawn() calls, from 0
+    long long last_timestamp; // us, CLOCK_MONOTONIC
+    long long total_time;     // us
+    long long switch_count;
+    long long io_switch_count; // switches away while waiting for I/O
+    long long io_wait_time;   // us from waiting for requests until resuming
+    pthread_mutex_t lock;     // protects is_finished and joiners
+    int is_finished;
+    struct coro_struct *joiners;   // parked in coro_join() on this coroutine
+    struct coro_struct *wait_next; // in a list of parked coroutines
+    struct coro_struct *all_next;  // in the list of all coroutines of sched
+} coro_struct;
+
+// FIFO ring buffer of coroutines, grows when full
+typedef struct coro_queue
+{
+    coro_struct **items;
+    int head, count, capacity;
+} coro_queue;
+
+// a coroutine sleeping until deadline
+typedef struct coro_timer
+{
+    long long deadline; // us, CLOCK_MONOTONIC
+    coro_struct *coro;
+} coro_timer;
+
+// OS thread running its own coroutine scheduler
+struct coro_worker
+{
+    pthread_t thread;
+    int id;
+    coro_sched *sched;
+    pthread_mutex_t lock;         // protects pending, inbox and is_idle
+    coro_queue pending;           // coroutines not started yet, other workers steal them
+    coro_queue inbox;             // coroutines woken by other threads
+    int is_idle;                  // blocked until event_fd is written
+    int event_fd;
+    coro_queue runnable;          // started coroutines, accessed by the owner only
+    int active_count;             // started and not finished coroutines
+    coro_context sched_context;   // worker loop, resumed when nothing is runnable
+    coro_struct *current;
+    io_ring ring;                 // reads and writes of the worker's coroutines
+    int has_ring;                 // POSIX AIO is used when io_uring is not available
+    int io_waiting;               // coroutines parked until their request completes
+    int io_in_flight;             // io_uring requests submitted and not reaped yet
+    struct aiocb **aio_waiting;   // POSIX AIO requests of the parked coroutines
+    int aio_capacity;
+    coro_timer *timers;           // binary min-heap on the deadline
+    int timer_count, timer_capacity;
+    coro_stack_pool stacks;       // stacks of the coroutines started on the worker
+    void *signal_stack;           // the overflow handler runs on it
+    long long busy_time;          // us spent in coroutines
+    int started_count, stolen_count;
+};
+
+#ifdef CORO_HOOKS
+// called on the worker when the slice of a coroutine ends, with the reason
+// and the us it started at and lasted
+typedef void (*coro_slice_hook)(void *arg, int worker, int coro_id, const char *reason,
+                                long long start, long long duration);
+#endif
+
+typedef struct coro_config
+{
+    int workers;           // threads, the one calling coro_sched_run() included
+    // coroutines a worker interleaves at once, 0 for any number; a parked
+    // coroutine keeps its slot, so ones waiting for each other on channels
+    // or joins may deadlock under a limit smaller than their number
+    int active_limit;
+    size_t stack_size;     // usable bytes of a coroutine stack
+    long long quantum;     // us of CPU a coroutine runs before a switch
+    int use_aio;           // POSIX AIO even if io_uring is available
+#ifdef CORO_HOOKS
+    coro_slice_hook on_slice;  // may be NULL
+    void *hook_arg;
+#endif
+} coro_config;
+
+struct coro_sched
+{
+    coro_config config;
+    coro_worker *workers;
+    int workers_count;
+    int next_worker;           // coroutines spawned outside of the workers go round-robin
+    pthread_mutex_t lock;      // protects all and spawned_count
+    coro_struct *all;          // every coroutine, freed by coro_sched_destroy()
+    int spawned_count;
+    int live_count;            // spawned and not finished, atomic
+};
+
+// A read or a write of a coroutine: started by coro_io_start() and waited
+// for by coro_io_wait(), the coroutine keeps running in between.
+typedef struct io_request
+{
+    coro_struct *coro;
+    ssize_t result;             // bytes transferred or -errno once done
+    int is_done;
+    int is_waited;              // io_uring: the coroutine is parked until it is done
+    struct aiocb control_block; // POSIX AIO
+} io_request;
+
+// Bounded FIFO of pointers between coroutines, of any workers. A sender
+// parks while it is full, a receiver while it is empty.
+typedef struct coro_channel
+{
+    pthread_mutex_t lock;
+    void **items;
+    size_t head, count, capacity;
+    int is_closed;
+    coro_struct *senders, *senders_tail;     // parked, in FIFO order
+    coro_struct *receivers, *receivers_tail;
+} coro_channel;
+
+// Parks coroutines until count of them have arrived, then releases them all
+// and starts over.
+typedef struct coro_barrier
+{
+    pthread_mutex_t lock;
+    int count, arrived;
+    coro_struct *waiters;
+} coro_barrier;
+
+void coro_sched_init(coro_sched *sched, const coro_config *config);
+// frees the coroutines too, coro_sched_run() must have returned
+void coro_sched_destroy(coro_sched *sched);
+
+// queues func(arg) to run as a coroutine of sched, may be called before
+// coro_sched_run() or from a coroutine of sched
+coro_struct* coro_spawn(coro_sched *sched, void *(*func)(void *), void *arg);
+// runs the workers, the calling thread is worker 0, returns once every
+// coroutine, spawned ones included, has finished
+void coro_sched_run(coro_sched *sched);
+
+// the running coroutine, NULL outside of coroutines
+coro_struct* coro_current();
+// us of CPU the running coroutine has used so far
+long long coro_run_time();
+// unconditionally switches to the next coroutine of the worker
+void coro_yield();
+// parks the running coroutine for at least us
+void coro_sleep(long long us);
+// parks the running coroutine until coro finishes, returns its result
+void* coro_join(coro_struct *coro);
+
+// how much work is done between two clock reads in coro_check_quantum()
+#define CORO_QUANTUM_CHECK_PERIOD 256
+
+extern __thread int coro_quantum_checks_left;
+// slow path of coro_check_quantum(): reads the clock
+void coro_check_quantum_slow();
+
+// accounts n units of work, e.g. processed elements, and switches to the next
+// coroutine if the current one used up its quantum,
+// the clock is read once per CORO_QUANTUM_CHECK_PERIOD units
+#define coro_check_quantum_n(n) do { \
+    if ((coro_quantum_checks_left -= (n)) <= 0) \
+        coro_check_quantum_slow(); \
+} while (0)
+
+#define coro_check_quantum() coro_check_quantum_n(1)
+
+// submits a transfer of up to count bytes between buf and fd at offset, a
+// coroutine has one request in flight at most
+void coro_io_start(io_request *request, int fd, void *buf, size_t count, off_t offset,
+                   int is_write);
+// returns the result of the request once it completes, -1 and errno on failure
+ssize_t coro_io_wait(io_request *request);
+ssize_t coro_io(int fd, void *buf, size_t count, off_t offset, int is_write);
+
+// capacity is at least 1
+void coro_channel_init(coro_channel *channel, size_t capacity);
+// nobody may be parked on the channel
+void coro_channel_destroy(coro_channel *channel);
+// returns 0, or -1 if the channel is closed
+int coro_channel_send(coro_channel *channel, void *item);
+// returns 0, or -1 once the channel is closed and empty
+int coro_channel_recv(coro_channel *channel, void **item);
+// wakes everybody parked on the channel, the items sent stay to be received
+void coro_channel_close(coro_channel *channel);
+
+// count coroutines meet at the barrier, count is at least 1
+void coro_barrier_init(coro_barrier *barrier, int count);
+void coro_barrier_destroy(coro_barrier *barrier);
+// returns 1 in the last coroutine to arrive and 0 in the others, which
+// are parked until then
+int coro_barrier_wait(coro_barrier *barrier);
+
+#endif
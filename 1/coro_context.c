@@ -0,0 +1,171 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coro_context.h"
+
+#ifdef CORO_USE_UCONTEXT
+
+// makecontext() passes only int arguments, so the pointer is split in halves
+static void coro_context_trampoline(unsigned int hi, unsigned int lo)
+{
+    coro_context *ctx = (coro_context *)(uintptr_t)(((unsigned long long)hi << 32) | lo);
+    ctx->func(ctx->arg);
+    abort();
+}
+
+void coro_context_init(coro_context *ctx, void *stack, size_t stack_size,
+                       void (*func)(void *), void *arg)
+{
+    unsigned long long ptr = (uintptr_t)ctx;
+
+    ctx->func = func;
+    ctx->arg = arg;
+    getcontext(&ctx->uc);
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = stack_size;
+    ctx->uc.uc_link = NULL;
+    makecontext(&ctx->uc, (void (*)(void))coro_context_trampoline, 2,
+                (unsigned int)(ptr >> 32), (unsigned int)ptr);
+}
+
+void coro_context_switch(coro_context *from, coro_context *to)
+{
+    swapcontext(&from->uc, &to->uc);
+}
+
+#else
+
+void coro_context_trampoline(void);
+
+#if defined(__x86_64__)
+
+// Frame of a suspended context, from the saved stack pointer upwards:
+// mxcsr and x87 control word, r15, r14, r13, r12, rbx, rbp, return address.
+// A fresh context "returns" into the trampoline with func in r12 and arg in r13.
+__asm__(
+    ".text\n"
+    ".globl coro_context_switch\n"
+    ".type coro_context_switch, @function\n"
+    ".p2align 4\n"
+    "coro_context_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq (%rsi), %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size coro_context_switch, .-coro_context_switch\n"
+    "\n"
+    ".globl coro_context_trampoline\n"
+    ".type coro_context_trampoline, @function\n"
+    ".p2align 4\n"
+    "coro_context_trampoline:\n"
+    "    movq %r13, %rdi\n"
+    "    callq *%r12\n"
+    "    ud2\n"
+    ".size coro_context_trampoline, .-coro_context_trampoline\n"
+);
+
+enum { FRAME_WORDS = 8 };
+
+void coro_context_init(coro_context *ctx, void *stack, size_t stack_size,
+                       void (*func)(void *), void *arg)
+{
+    // the trampoline is entered by ret, so the stack must be 16-byte aligned
+    // right after popping the return address, as if it had been called
+    uintptr_t top = ((uintptr_t)stack + stack_size) & ~(uintptr_t)15;
+    uintptr_t *frame = (uintptr_t *)top - FRAME_WORDS;
+    uint32_t control[2] = {0x1f80, 0x037f}; // default mxcsr and x87 control word
+
+    memset(frame, 0, FRAME_WORDS * sizeof(*frame));
+    memcpy(&frame[0], control, sizeof(control));
+    frame[3] = (uintptr_t)arg;                     // r13
+    frame[4] = (uintptr_t)func;                    // r12
+    frame[7] = (uintptr_t)coro_context_trampoline; // return address
+    ctx->sp = frame;
+}
+
+#else // __aarch64__
+
+// Frame of a suspended context, from the saved stack pointer upwards:
+// x19-x28, x29 (fp), x30 (lr), d8-d15.
+// A fresh context "returns" into the trampoline with func in x19 and arg in x20.
+__asm__(
+    ".text\n"
+    ".globl coro_context_switch\n"
+    ".type coro_context_switch, %function\n"
+    ".p2align 4\n"
+    "coro_context_switch:\n"
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x2, sp\n"
+    "    str x2, [x0]\n"
+    "    ldr x2, [x1]\n"
+    "    mov sp, x2\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+    ".size coro_context_switch, .-coro_context_switch\n"
+    "\n"
+    ".globl coro_context_trampoline\n"
+    ".type coro_context_trampoline, %function\n"
+    ".p2align 4\n"
+    "coro_context_trampoline:\n"
+    "    mov x0, x20\n"
+    "    blr x19\n"
+    "    brk #0\n"
+    ".size coro_context_trampoline, .-coro_context_trampoline\n"
+);
+
+enum { FRAME_WORDS = 20 };
+
+void coro_context_init(coro_context *ctx, void *stack, size_t stack_size,
+                       void (*func)(void *), void *arg)
+{
+    uintptr_t top = ((uintptr_t)stack + stack_size) & ~(uintptr_t)15;
+    uintptr_t *frame = (uintptr_t *)top - FRAME_WORDS;
+
+    memset(frame, 0, FRAME_WORDS * sizeof(*frame));
+    frame[0] = (uintptr_t)func;                     // x19
+    frame[1] = (uintptr_t)arg;                      // x20
+    frame[11] = (uintptr_t)coro_context_trampoline; // x30
+    ctx->sp = frame;
+}
+
+#endif
+
+#endif
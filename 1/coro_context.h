@@ -0,0 +1,50 @@
+#ifndef CORO_CONTEXT_H
+#define CORO_CONTEXT_H
+
+#include <stddef.h>
+
+// The hand-written switch saves only callee-saved registers and does no
+// syscalls. Define CORO_USE_UCONTEXT to fall back to swapcontext(), which is
+// also used on platforms without an assembly implementation.
+#if !defined(CORO_USE_UCONTEXT) && \
+    !(defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__)))
+#define CORO_USE_UCONTEXT
+#endif
+
+#ifdef CORO_USE_UCONTEXT
+
+#include <ucontext.h>
+
+#define CORO_CONTEXT_BACKEND "ucontext"
+
+typedef struct coro_context
+{
+    ucontext_t uc;
+    void (*func)(void *);
+    void *arg;
+} coro_context;
+
+#else
+
+#if defined(__x86_64__)
+#define CORO_CONTEXT_BACKEND "asm x86-64"
+#else
+#define CORO_CONTEXT_BACKEND "asm aarch64"
+#endif
+
+typedef struct coro_context
+{
+    void *sp; // registers of a suspended context are saved on its own stack
+} coro_context;
+
+#endif
+
+// prepares ctx to run func(arg) on the given stack,
+// func must never return, it has to switch to another context instead
+void coro_context_init(coro_context *ctx, void *stack, size_t stack_size,
+                       void (*func)(void *), void *arg);
+
+// saves the current execution state into from and resumes to
+void coro_context_switch(coro_context *from, coro_context *to);
+
+#endif
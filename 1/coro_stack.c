@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "coro_stack.h"
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#ifndef MAP_STACK
+#define MAP_STACK 0
+#endif
+
+void coro_stack_pool_init(coro_stack_pool *pool, size_t stack_size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    pool->stack_size = (stack_size + page - 1) / page * page;
+    pool->guard_size = page;
+    pool->free_stacks = NULL;
+    pool->free_count = pool->free_capacity = 0;
+    pool->mapped_count = pool->reused_count = 0;
+}
+
+void coro_stack_pool_destroy(coro_stack_pool *pool)
+{
+    for (int i = 0; i < pool->free_count; ++i)
+        munmap((char *)pool->free_stacks[i] - pool->guard_size,
+               pool->guard_size + pool->stack_size);
+    free(pool->free_stacks);
+    pool->free_stacks = NULL;
+    pool->free_count = pool->free_capacity = 0;
+}
+
+void* coro_stack_alloc(coro_stack_pool *pool)
+{
+    if (pool->free_count) {
+        pool->reused_count++;
+        return pool->free_stacks[--pool->free_count];
+    }
+
+    // every mapped stack has its slot among the free ones, so that freeing
+    // needs no allocation, it runs on the very stack being freed
+    if (pool->free_capacity == pool->mapped_count) {
+        int capacity = pool->free_capacity ? pool->free_capacity * 2 : 16;
+        void **free_stacks = realloc(pool->free_stacks, capacity * sizeof(void *));
+        if (!free_stacks)
+            return NULL;
+        pool->free_stacks = free_stacks;
+        pool->free_capacity = capacity;
+    }
+
+    // no swap is reserved for the whole stack, only touched pages count
+    char *mapping = mmap(NULL, pool->guard_size + pool->stack_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (mapping == MAP_FAILED)
+        return NULL;
+    // stacks grow down, the guard is at the lowest address
+    if (mprotect(mapping, pool->guard_size, PROT_NONE) < 0) {
+        munmap(mapping, pool->guard_size + pool->stack_size);
+        return NULL;
+    }
+
+    pool->mapped_count++;
+    return mapping + pool->guard_size;
+}
+
+void coro_stack_free(coro_stack_pool *pool, void *stack)
+{
+    pool->free_stacks[pool->free_count++] = stack;
+}
+
+int coro_stack_is_guard(const coro_stack_pool *pool, const void *stack, const void *addr)
+{
+    const char *guard = (const char *)stack - pool->guard_size;
+    return (const char *)addr >= guard && (const char *)addr < (const char *)stack;
+}
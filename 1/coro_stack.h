@@ -0,0 +1,36 @@
+#ifndef CORO_STACK_H
+#define CORO_STACK_H
+
+#include <stddef.h>
+
+// Pool of coroutine stacks. Every stack is an anonymous mapping with a
+// PROT_NONE guard page below it, so an overflow faults instead of running
+// into the neighbouring memory. The kernel commits stack pages on first
+// touch, a big stack costs only as much as is used of it. Freed stacks are
+// kept in the pool and handed out again as they are, warm.
+// Not thread-safe, every scheduler thread owns its pool.
+typedef struct coro_stack_pool
+{
+    size_t stack_size; // usable bytes, a multiple of the page size
+    size_t guard_size;
+    void **free_stacks;      // room for every mapped stack
+    int free_count, free_capacity;
+    int mapped_count;  // stacks mapped by the pool
+    int reused_count;  // allocations served from the free stacks
+} coro_stack_pool;
+
+// stack_size is rounded up to whole pages
+void coro_stack_pool_init(coro_stack_pool *pool, size_t stack_size);
+// unmaps the free stacks, all the stacks must be freed by then
+void coro_stack_pool_destroy(coro_stack_pool *pool);
+
+// returns the lowest usable address of a stack of pool->stack_size bytes,
+// NULL and errno on failure
+void* coro_stack_alloc(coro_stack_pool *pool);
+// allocates nothing, so it may be called on the stack being freed
+void coro_stack_free(coro_stack_pool *pool, void *stack);
+
+// whether addr is in the guard page of the stack
+int coro_stack_is_guard(const coro_stack_pool *pool, const void *stack, const void *addr);
+
+#endif
@@ -1,21 +1,80 @@
 import random
 import argparse
+import struct
+import sys
+from array import array
 
 maxint = 1 << 31
 
 parser = argparse.ArgumentParser(description = "Generate random numbers file")
 parser.add_argument('-f', type=str, required=True, help="file name")
-parser.add_argument('-c', type=int, required=True, help='number count')
-parser.add_argument('-m', type=int, default=maxint, help='maximal number')
+parser.add_argument('-c', type=int, help='number count')
+parser.add_argument('-m', type=int, help='maximal number, 2^31 for int32 '\
+					 'and 2^63 - 1 otherwise by default')
+parser.add_argument('-t', type=str, default='int32',
+		    choices=['int32', 'int64', 'record'],
+		    help='element type, a record is an int64 key followed by '\
+			 'an int64 payload, its index in the file')
+parser.add_argument('-d', type=str, default='uniform',
+		    choices=['uniform', 'sorted', 'reverse', 'nearly-sorted',
+			     'appended', 'few-unique', 'skewed'],
+		    help='distribution of the generated numbers: uniform in '\
+			 '[0, m], the same sorted up or down, sorted with 1%% '\
+			 'of them moved, 16 sorted parts one after another '\
+			 'like an appended log, 16 distinct values, or a '\
+			 'Pareto tail with most numbers small')
+parser.add_argument('-b', action='store_true', help='write the binary format: '\
+					'"SRTB", version 1, element size 4, 8 '\
+					'or 16, 2 reserved bytes, 64-bit count, '\
+					'then little-endian elements')
+parser.add_argument('-i', type=str, help='convert the numbers of this text '\
+					 'file instead of generating them')
 args = parser.parse_args()
 random.seed()
+if args.m is None:
+	args.m = maxint if args.t == 'int32' else (1 << 63) - 1
 
+if args.i is not None:
+	f = open(args.i, 'r')
+	numbers = [int(v) for v in f.read().split()]
+	f.close()
+elif args.c is not None:
+	if args.d == 'few-unique':
+		values = [random.randint(0, args.m) for i in range(0, 16)]
+		numbers = [random.choice(values) for i in range(0, args.c)]
+	elif args.d == 'skewed':
+		numbers = [min(args.m, int(random.paretovariate(1.0)) - 1)
+			   for i in range(0, args.c)]
+	else:
+		numbers = [random.randint(0, args.m) for i in range(0, args.c)]
+	if args.d in ('sorted', 'reverse', 'nearly-sorted'):
+		numbers.sort(reverse=args.d == 'reverse')
+	if args.d == 'nearly-sorted':
+		for i in range(0, args.c // 100):
+			j, k = random.randrange(args.c), random.randrange(args.c)
+			numbers[j], numbers[k] = numbers[k], numbers[j]
+	if args.d == 'appended':
+		parts = [sorted(numbers[args.c * i // 16 : args.c * (i + 1) // 16])
+			 for i in range(0, 16)]
+		numbers = [v for part in parts for v in part]
+	if args.t == 'record':
+		numbers = [v for i in range(0, args.c) for v in (numbers[i], i)]
+else:
+	parser.error('either -c or -i is required')
 
-f = open(args.f, 'w')
 
-for i in range(0, args.c):
-	f.write(str(random.randint(0, args.m)))
-	if i + 1 != args.c:
-		f.write(' ')
-
-f.close()
+if args.b:
+	data = array('i' if args.t == 'int32' else 'q', numbers)
+	if sys.byteorder == 'big':
+		data.byteswap()
+	# a record is two numbers
+	fields = 2 if args.t == 'record' else 1
+	f = open(args.f, 'wb')
+	f.write(struct.pack('<4sBB2xQ', b'SRTB', 1, data.itemsize * fields,
+			    len(data) // fields))
+	f.write(data.tobytes())
+	f.close()
+else:
+	f = open(args.f, 'w')
+	f.write(' '.join(str(v) for v in numbers))
+	f.close()
@@ -0,0 +1,177 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "io_ring.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int io_ring_init(io_ring *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = io_uring_setup(entries, &params);
+    if (ring->fd < 0)
+        return -1;
+    ring->entries = params.sq_entries;
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // old kernels map the two rings separately
+    int single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && ring->cq_size > ring->sq_size)
+        ring->sq_size = ring->cq_size;
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        goto fail;
+    if (single_mmap) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+            goto fail_sq;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail_cq;
+
+    char *sq = ring->sq_ptr, *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+
+fail_cq:
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+fail_sq:
+    munmap(ring->sq_ptr, ring->sq_size);
+fail:
+    {
+        int err = errno;
+        close(ring->fd);
+        errno = err;
+    }
+    return -1;
+}
+
+void io_ring_destroy(io_ring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+}
+
+static int io_ring_submit(io_ring *ring, int opcode, int fd, void *buf, unsigned count,
+                          unsigned long long offset, void *user_data)
+{
+    // requests are submitted one by one, so the queue never fills up
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(unsigned long)buf;
+    sqe->len = count;
+    sqe->off = offset;
+    sqe->user_data = (unsigned long long)(unsigned long)user_data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while (io_uring_enter(ring->fd, 1, 0, 0) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+int io_ring_read(io_ring *ring, int fd, void *buf, unsigned count,
+                 unsigned long long offset, void *user_data)
+{
+    return io_ring_submit(ring, IORING_OP_READ, fd, buf, count, offset, user_data);
+}
+
+int io_ring_write(io_ring *ring, int fd, const void *buf, unsigned count,
+                  unsigned long long offset, void *user_data)
+{
+    return io_ring_submit(ring, IORING_OP_WRITE, fd, (void *)buf, count, offset, user_data);
+}
+
+int io_ring_peek(io_ring *ring, void **user_data, int *res)
+{
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = (void *)(unsigned long)cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#else
+
+int io_ring_init(io_ring *ring, unsigned entries)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+void io_ring_destroy(io_ring *ring)
+{
+}
+
+int io_ring_read(io_ring *ring, int fd, void *buf, unsigned count,
+                 unsigned long long offset, void *user_data)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int io_ring_write(io_ring *ring, int fd, const void *buf, unsigned count,
+                  unsigned long long offset, void *user_data)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int io_ring_peek(io_ring *ring, void **user_data, int *res)
+{
+    return 0;
+}
+
+#endif
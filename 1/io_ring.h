@@ -0,0 +1,37 @@
+#ifndef SORT_IO_RING_H
+#define SORT_IO_RING_H
+
+#include <stddef.h>
+
+// Minimal io_uring wrapper on top of the raw syscalls: requests are queued with
+// a user pointer which comes back with the completion. Not thread-safe, every
+// scheduler thread owns its ring.
+typedef struct io_ring
+{
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned entries;
+} io_ring;
+
+// returns -1 and sets errno if io_uring is not available
+int io_ring_init(io_ring *ring, unsigned entries);
+void io_ring_destroy(io_ring *ring);
+
+// queues and submits a read, returns -1 and sets errno on failure
+int io_ring_read(io_ring *ring, int fd, void *buf, unsigned count,
+                 unsigned long long offset, void *user_data);
+// the same for a write of count bytes from buf
+int io_ring_write(io_ring *ring, int fd, const void *buf, unsigned count,
+                  unsigned long long offset, void *user_data);
+
+// takes one completion if there is any: returns 1 and fills user_data and
+// res (bytes transferred or -errno), returns 0 otherwise
+int io_ring_peek(io_ring *ring, void **user_data, int *res);
+
+#endif
@@ -0,0 +1,187 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "output.h"
+
+const char digit_pairs[200] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static void write_all(int fd, const char *buf, size_t size)
+{
+    while (size) {
+        ssize_t written = write(fd, buf, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            exit(1);
+        }
+        buf += written;
+        size -= written;
+    }
+}
+
+static void pwrite_all(int fd, const char *buf, size_t size, off_t offset)
+{
+    while (size) {
+        ssize_t written = pwrite(fd, buf, size, offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("pwrite");
+            exit(1);
+        }
+        buf += written;
+        size -= written;
+        offset += written;
+    }
+}
+
+static long long get_time_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void* output_writer_thread(void *arg)
+{
+    output_writer *writer = arg;
+
+    pthread_mutex_lock(&writer->lock);
+    while (1) {
+        while (!writer->pending && !writer->stop)
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        if (!writer->pending)
+            break;
+
+        char *buf = writer->pending;
+        size_t size = writer->pending_size;
+        pthread_mutex_unlock(&writer->lock);
+
+        long long start = get_time_us();
+        if (writer->offset < 0) {
+            write_all(writer->fd, buf, size);
+        } else {
+            pwrite_all(writer->fd, buf, size, writer->offset);
+            writer->offset += size;
+        }
+
+        long long write_time = get_time_us() - start;
+
+        pthread_mutex_lock(&writer->lock);
+        writer->bytes_written += size;
+        writer->write_time += write_time;
+        writer->pending = NULL;
+        pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+static void output_writer_init(output_writer *writer, int fd, off_t offset)
+{
+    writer->fd = fd;
+    writer->offset = offset;
+
+    for (int i = 0; i < 2; ++i) {
+        writer->buffers[i] = malloc(OUTPUT_BUFFER_SIZE);
+        if (!writer->buffers[i]) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+    writer->buf = writer->buffers[0];
+    writer->size = 0;
+    writer->bytes_written = 0;
+    writer->write_time = 0;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    writer->pending = NULL;
+    writer->pending_size = 0;
+    writer->stop = 0;
+
+    int err = pthread_create(&writer->thread, NULL, output_writer_thread, writer);
+    if (err) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        exit(1);
+    }
+}
+
+void output_writer_open(output_writer *writer, const char *filename)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(filename);
+        exit(1);
+    }
+    output_writer_init(writer, fd, -1);
+}
+
+void output_writer_open_at(output_writer *writer, int fd, off_t offset)
+{
+    output_writer_init(writer, fd, offset);
+}
+
+void output_writer_flush(output_writer *writer)
+{
+    if (!writer->size)
+        return;
+
+    pthread_mutex_lock(&writer->lock);
+    while (writer->pending) // the other buffer is still being written
+        pthread_cond_wait(&writer->cond, &writer->lock);
+    writer->pending = writer->buf;
+    writer->pending_size = writer->size;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+
+    writer->buf = writer->buf == writer->buffers[0] ? writer->buffers[1] : writer->buffers[0];
+    writer->size = 0;
+}
+
+void output_writer_put_bytes(output_writer *writer, const void *data, size_t size)
+{
+    const char *bytes = data;
+    while (size) {
+        if (writer->size == OUTPUT_BUFFER_SIZE)
+            output_writer_flush(writer);
+        size_t count = OUTPUT_BUFFER_SIZE - writer->size < size ? OUTPUT_BUFFER_SIZE - writer->size : size;
+        memcpy(writer->buf + writer->size, bytes, count);
+        writer->size += count;
+        bytes += count;
+        size -= count;
+    }
+}
+
+void output_writer_close(output_writer *writer)
+{
+    output_writer_flush(writer);
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = 1;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->cond);
+    if (writer->offset < 0)
+        close(writer->fd);
+    free(writer->buffers[0]);
+    free(writer->buffers[1]);
+}
@@ -0,0 +1,182 @@
+#ifndef SORT_OUTPUT_H
+#define SORT_OUTPUT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+// the longest formatted number is "-2147483648 "
+#define OUTPUT_INT_MAX_LEN 12
+// and "-9223372036854775808 " of 64 bits
+#define OUTPUT_INT64_MAX_LEN 21
+
+// Buffered writer of formatted numbers. Two buffers are used in turns:
+// while one is filled by the caller, the other is written out by a
+// background thread with big write() calls.
+typedef struct output_writer
+{
+    int fd;
+    off_t offset;   // where the next pwrite() goes, -1 if the writer appends with write()
+    char *buffers[2];
+    char *buf;      // the buffer being filled
+    size_t size;    // bytes used in buf
+    long long bytes_written;
+    long long write_time; // us the background thread spent writing
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *pending;  // buffer handed over to the thread, NULL when it is idle
+    size_t pending_size;
+    int stop;
+} output_writer;
+
+// "00" "01" ... "99"
+extern const char digit_pairs[200];
+
+void output_writer_open(output_writer *writer, const char *filename);
+// writes to the open fd from offset on with pwrite(), so that several
+// writers can fill disjoint parts of one file at once, fd is left open
+void output_writer_open_at(output_writer *writer, int fd, off_t offset);
+// hands the filled buffer over to the background thread
+void output_writer_flush(output_writer *writer);
+// appends size raw bytes
+void output_writer_put_bytes(output_writer *writer, const void *data, size_t size);
+// writes out everything buffered and closes the file
+void output_writer_close(output_writer *writer);
+
+static inline int count_digits(unsigned int value)
+{
+    if (value < 10) return 1;
+    if (value < 100) return 2;
+    if (value < 1000) return 3;
+    if (value < 10000) return 4;
+    if (value < 100000) return 5;
+    if (value < 1000000) return 6;
+    if (value < 10000000) return 7;
+    if (value < 100000000) return 8;
+    if (value < 1000000000) return 9;
+    return 10;
+}
+
+static inline int count_digits64(uint64_t value)
+{
+    int digits = 1;
+    for (; value >= 10000; value /= 10000)
+        digits += 4;
+    return digits + (value >= 10) + (value >= 100) + (value >= 1000);
+}
+
+// the length format_int() and format_int64() produce
+static inline size_t format_int_len(int value)
+{
+    return (value < 0) + count_digits(value < 0 ? -(unsigned int)value : value) + 1;
+}
+
+static inline size_t format_int64_len(int64_t value)
+{
+    return (value < 0) + count_digits64(value < 0 ? -(uint64_t)value : value) + 1;
+}
+
+// writes value followed by a space to dst, returns the length,
+// two digits are produced per division
+static inline size_t format_int(char *dst, int value)
+{
+    char *p = dst;
+    unsigned int v = value;
+    if (value < 0) {
+        *p++ = '-';
+        v = -v;
+    }
+
+    char *end = p + count_digits(v);
+    char *q = end;
+    while (v >= 100) {
+        unsigned int pair = v % 100;
+        v /= 100;
+        q -= 2;
+        memcpy(q, &digit_pairs[pair * 2], 2);
+    }
+    if (v >= 10)
+        memcpy(q - 2, &digit_pairs[v * 2], 2);
+    else
+        q[-1] = '0' + v;
+
+    *end = ' ';
+    return end + 1 - dst;
+}
+
+// format_int() of a 64-bit value, the digits are produced into a scratch
+// buffer from the end since their count isn't known up front
+static inline size_t format_int64(char *dst, int64_t value)
+{
+    char *p = dst;
+    uint64_t v = value;
+    if (value < 0) {
+        *p++ = '-';
+        v = -v;
+    }
+
+    char digits[20];
+    char *q = digits + sizeof(digits);
+    while (v >= 100) {
+        unsigned int pair = v % 100;
+        v /= 100;
+        q -= 2;
+        memcpy(q, &digit_pairs[pair * 2], 2);
+    }
+    if (v >= 10) {
+        q -= 2;
+        memcpy(q, &digit_pairs[v * 2], 2);
+    } else {
+        *--q = '0' + v;
+    }
+
+    size_t len = digits + sizeof(digits) - q;
+    memcpy(p, q, len);
+    p[len] = ' ';
+    return p + len + 1 - dst;
+}
+
+static inline void output_writer_put_int(output_writer *writer, int value)
+{
+    if (writer->size + OUTPUT_INT_MAX_LEN > OUTPUT_BUFFER_SIZE)
+        output_writer_flush(writer);
+    writer->size += format_int(writer->buf + writer->size, value);
+}
+
+static inline void output_writer_put_int64(output_writer *writer, int64_t value)
+{
+    if (writer->size + OUTPUT_INT64_MAX_LEN > OUTPUT_BUFFER_SIZE)
+        output_writer_flush(writer);
+    writer->size += format_int64(writer->buf + writer->size, value);
+}
+
+// appends value as 4 raw little-endian bytes
+static inline void output_writer_put_binary_int(output_writer *writer, int value)
+{
+    if (writer->size + sizeof(value) > OUTPUT_BUFFER_SIZE)
+        output_writer_flush(writer);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    memcpy(writer->buf + writer->size, &value, sizeof(value));
+    writer->size += sizeof(value);
+}
+
+// appends value as 8 raw little-endian bytes
+static inline void output_writer_put_binary_int64(output_writer *writer, int64_t value)
+{
+    if (writer->size + sizeof(value) > OUTPUT_BUFFER_SIZE)
+        output_writer_flush(writer);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    memcpy(writer->buf + writer->size, &value, sizeof(value));
+    writer->size += sizeof(value);
+}
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "parse.h"
+
+void int_vector_reserve(int_vector *vec, size_t capacity)
+{
+    if (capacity <= vec->capacity)
+        return;
+
+    vec->data = realloc(vec->data, capacity * sizeof(int));
+    if (!vec->data) {
+        perror("realloc");
+        exit(1);
+    }
+    vec->capacity = capacity;
+}
+
+void int_vector_shrink(int_vector *vec)
+{
+    if (!vec->size || vec->size == vec->capacity)
+        return;
+
+    int *data = realloc(vec->data, vec->size * sizeof(int));
+    if (data) {
+        vec->data = data;
+        vec->capacity = vec->size;
+    }
+}
+
+// makes room for as many numbers as one call can possibly parse,
+// so that the parsing loops don't check the capacity
+static void reserve_for(int_vector *numbers, const char *p, const char *end, size_t max_count)
+{
+    // every number but the last one takes at least two bytes
+    size_t most = (end - p + 1) / 2;
+    if (most > max_count)
+        most = max_count;
+
+    if (numbers->size + most > numbers->capacity) {
+        size_t capacity = numbers->capacity * 2;
+        if (capacity < numbers->size + most)
+            capacity = numbers->size + most;
+        int_vector_reserve(numbers, capacity);
+    }
+}
+
+static inline int is_space(char c)
+{
+    return c == ' ' || (unsigned char)(c - '\t') < 5;
+}
+
+static inline int is_digit(char c)
+{
+    return (unsigned char)(c - '0') < 10;
+}
+
+size_t parse_ints_scalar(const char **pos, const char *end, int_vector *numbers, size_t max_count)
+{
+    const char *p = *pos;
+    reserve_for(numbers, p, end, max_count);
+    int *out = numbers->data + numbers->size;
+    size_t count = 0;
+
+    while (count < max_count) {
+        while (p < end && is_space(*p))
+            ++p;
+        if (p == end)
+            break;
+
+        const char *start = p;
+        int negative = *p == '-';
+        p += negative;
+        if (p == end || !is_digit(*p)) {
+            p = start;
+            break;
+        }
+
+        unsigned int value = 0;
+        while (p < end && is_digit(*p))
+            value = value * 10 + (*p++ - '0');
+        out[count++] = negative ? -value : value;
+    }
+
+    numbers->size += count;
+    *pos = p;
+    return count;
+}
+
+void int64_vector_reserve(int64_vector *vec, size_t capacity)
+{
+    if (capacity <= vec->capacity)
+        return;
+
+    vec->data = realloc(vec->data, capacity * sizeof(int64_t));
+    if (!vec->data) {
+        perror("realloc");
+        exit(1);
+    }
+    vec->capacity = capacity;
+}
+
+size_t parse_int64s(const char **pos, const char *end, int64_vector *numbers, size_t max_count)
+{
+    const char *p = *pos;
+    // room for as many numbers as the call can parse, as in reserve_for()
+    size_t most = (end - p + 1) / 2;
+    if (most > max_count)
+        most = max_count;
+    if (numbers->size + most > numbers->capacity) {
+        size_t capacity = numbers->capacity * 2;
+        if (capacity < numbers->size + most)
+            capacity = numbers->size + most;
+        int64_vector_reserve(numbers, capacity);
+    }
+    int64_t *out = numbers->data + numbers->size;
+    size_t count = 0;
+
+    while (count < max_count) {
+        while (p < end && is_space(*p))
+            ++p;
+        if (p == end)
+            break;
+
+        const char *start = p;
+        int negative = *p == '-';
+        p += negative;
+        if (p == end || !is_digit(*p)) {
+            p = start;
+            break;
+        }
+
+        uint64_t value = 0;
+        while (p < end && is_digit(*p))
+            value = value * 10 + (*p++ - '0');
+        out[count++] = negative ? -value : value;
+    }
+
+    numbers->size += count;
+    *pos = p;
+    return count;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#if defined(__AVX2__)
+
+#define PARSE_BLOCK 32
+const char *parse_ints_impl = "avx2";
+
+// bit i of digits (spaces, minuses) is set if p[i] is a digit (whitespace, '-')
+static inline void classify_block(const char *p, uint64_t *digits, uint64_t *spaces,
+                                  uint64_t *minuses)
+{
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+    __m256i digit = _mm256_sub_epi8(chunk, _mm256_set1_epi8('0'));
+    __m256i ctrl = _mm256_sub_epi8(chunk, _mm256_set1_epi8('\t'));
+    __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    __m256i is_space = _mm256_or_si256(
+        _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' ')),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(ctrl, _mm256_set1_epi8(4)), ctrl));
+    *digits = (uint32_t)_mm256_movemask_epi8(is_digit);
+    *spaces = (uint32_t)_mm256_movemask_epi8(is_space);
+    *minuses = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('-')));
+}
+
+#else
+
+#define PARSE_BLOCK 16
+const char *parse_ints_impl = "sse2";
+
+// bit i of digits (spaces, minuses) is set if p[i] is a digit (whitespace, '-')
+static inline void classify_block(const char *p, uint64_t *digits, uint64_t *spaces,
+                                  uint64_t *minuses)
+{
+    __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+    __m128i digit = _mm_sub_epi8(chunk, _mm_set1_epi8('0'));
+    __m128i ctrl = _mm_sub_epi8(chunk, _mm_set1_epi8('\t'));
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i is_space = _mm_or_si128(
+        _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')),
+        _mm_cmpeq_epi8(_mm_min_epu8(ctrl, _mm_set1_epi8(4)), ctrl));
+    *digits = (uint32_t)_mm_movemask_epi8(is_digit);
+    *spaces = (uint32_t)_mm_movemask_epi8(is_space);
+    *minuses = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('-')));
+}
+
+#endif
+
+// value of 8 digits packed in val, minus '0' each, the first one in the lowest byte
+static inline uint32_t eight_digits_value(uint64_t val)
+{
+    const uint64_t mask = 0x000000ff000000ff;
+    const uint64_t mul1 = 100 + (1000000ULL << 32);
+    const uint64_t mul2 = 1 + (10000ULL << 32);
+
+    val = val * 10 + (val >> 8);
+    return (((val & mask) * mul1) + (((val >> 16) & mask) * mul2)) >> 32;
+}
+
+// value of 1 to 8 digits at p, 8 bytes must be readable
+static inline uint32_t digits_value(const char *p, int len)
+{
+    uint64_t val;
+    memcpy(&val, p, sizeof(val));
+    val -= 0x3030303030303030ULL;
+    // the shift drops the bytes past the number and pads it with leading zeros
+    return eight_digits_value(val << (8 * (8 - len)));
+}
+
+// Every block is classified once, then all the numbers ending inside it are
+// converted straight from the bit masks. Blocks with anything unusual
+// (other characters, numbers longer than 10 digits) and the tail of the
+// buffer are left to the scalar parser.
+size_t parse_ints(const char **pos, const char *end, int_vector *numbers, size_t max_count)
+{
+    const uint64_t full = (1ULL << PARSE_BLOCK) - 1;
+    const char *p = *pos;
+    reserve_for(numbers, p, end, max_count);
+    int *out = numbers->data + numbers->size;
+    size_t count = 0;
+
+    // digits_value() may read 8 bytes starting at any digit of the block
+    while (count < max_count && end - p >= PARSE_BLOCK + 8) {
+        uint64_t digits, spaces, minuses;
+        classify_block(p, &digits, &spaces, &minuses);
+
+        // '-' is a sign only right before a digit, for the last byte of the
+        // block it is decided in the next one
+        uint64_t last_minus = minuses & (1ULL << (PARSE_BLOCK - 1));
+        uint64_t signs = minuses & (digits >> 1);
+        if ((digits | spaces | signs | last_minus) != full)
+            break;
+
+        uint64_t starts = digits & ~(digits << 1);
+        int next = PARSE_BLOCK - (last_minus != 0); // offset of the next block
+        while (starts) {
+            int start = __builtin_ctzll(starts);
+            int len = __builtin_ctzll(~(digits >> start));
+            int negative = ((signs << 1) >> start) & 1;
+            if (start + len == PARSE_BLOCK) { // may go on in the next block
+                next = start - negative;
+                break;
+            }
+            if (len > 10) {
+                p += start - negative;
+                goto scalar;
+            }
+
+            const char *number = p + start;
+            uint64_t value = len <= 8 ? digits_value(number, len) :
+                digits_value(number, len - 8) * 100000000ULL + digits_value(number + len - 8, 8);
+            out[count++] = negative ? -(unsigned int)value : (unsigned int)value;
+
+            starts &= starts - 1;
+            if (count == max_count) {
+                next = start + len;
+                break;
+            }
+        }
+        if (!next) // a number fills the whole block
+            break;
+        p += next;
+    }
+
+scalar:
+    numbers->size += count;
+    *pos = p;
+    if (count < max_count)
+        count += parse_ints_scalar(pos, end, numbers, max_count - count);
+    return count;
+}
+
+#else
+
+const char *parse_ints_impl = "scalar";
+
+size_t parse_ints(const char **pos, const char *end, int_vector *numbers, size_t max_count)
+{
+    return parse_ints_scalar(pos, end, numbers, max_count);
+}
+
+#endif
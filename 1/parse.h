@@ -0,0 +1,45 @@
+#ifndef SORT_PARSE_H
+#define SORT_PARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// growable array the parsed numbers are appended to
+typedef struct int_vector
+{
+    int *data;
+    size_t size;
+    size_t capacity;
+} int_vector;
+
+void int_vector_reserve(int_vector *vec, size_t capacity);
+// gives the unused capacity back
+void int_vector_shrink(int_vector *vec);
+
+// Parses at most max_count whitespace separated decimal integers starting at
+// *pos and appends them to numbers, *pos is moved past the parsed text.
+// Returns how many numbers were parsed: fewer than max_count means that either
+// the end of the buffer or a character which can't start a number was reached.
+size_t parse_ints(const char **pos, const char *end, int_vector *numbers, size_t max_count);
+
+// the same without SIMD, used for short tails and for comparison
+size_t parse_ints_scalar(const char **pos, const char *end, int_vector *numbers, size_t max_count);
+
+// the same for 64-bit numbers
+typedef struct int64_vector
+{
+    int64_t *data;
+    size_t size;
+    size_t capacity;
+} int64_vector;
+
+void int64_vector_reserve(int64_vector *vec, size_t capacity);
+
+// parse_ints() for 64-bit numbers, scalar only: the SIMD tokenizer
+// accumulates the digits of a number in 32 bits
+size_t parse_int64s(const char **pos, const char *end, int64_vector *numbers, size_t max_count);
+
+// name of the implementation parse_ints() uses
+extern const char *parse_ints_impl;
+
+#endif
@@ -1,310 +1,2225 @@
 #include <string.h>
 #include <stdio.h>
-#include <assert.h>
+#include <ctype.h>
 #include <stdlib.h>
-#include <ucontext.h>
-#include <signal.h>
 #include <time.h>
-#include <aio.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <limits.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/resource.h>
 
-typedef struct coro_struct
-{
-    ucontext_t context;
-    clock_t last_timestamp;
-    clock_t total_time;
-    int is_finished;
-} coro_struct;
+#include "arena.h"
+#include "binary_format.h"
+#include "coro.h"
+#include "output.h"
+#include "parse.h"
+#include "trace.h"
+
+// INSTRUMENT=1 builds count the bytes and the allocations of every coroutine
+// and can record a trace of the scheduling, other builds have none of it
+#ifdef SORT_INSTRUMENT
+#define INSTRUMENT(...) __VA_ARGS__
+#else
+#define INSTRUMENT(...)
+#endif
 
 typedef struct array_struct
 {
-    int *p_arr;
-    size_t size;
+    void *data;
+    size_t size; // elements
+    arena arena; // data is in it, with the other buffers of the file
 } array_struct;
 
-static coro_struct *coros;
-static int curr_coro_i, files_count;
+// sorted run spilled to a temporary file in the external-memory mode
+typedef struct spilled_run
+{
+    int fd;
+    off_t offset; // bytes
+    size_t size;  // elements
+} spilled_run;
+
+typedef struct run_list
+{
+    spilled_run *runs;
+    int count, capacity;
+} run_list;
+
+// parts of the work of a coroutine, each is charged with the running time
+// of the coroutine spent in it
+typedef enum coro_phase
+{
+    PHASE_READ,  // reading or mapping the file, waiting for I/O is not counted
+    PHASE_PARSE, // parsing text or copying binary elements
+    PHASE_PARTITION, // --sample-sort: sampling and moving elements to their buckets
+    PHASE_SORT,
+    PHASE_SPILL, // writing sorted runs, the external-memory mode
+    PHASE_COUNT
+} coro_phase;
+
+static const char *coro_phase_names[] = {"read", "parse", "partition", "sort", "spill"};
+// --stats: JSON with the timings of the run is written to this file
+static const char *stats_path;
+// --trace: Chrome trace events of the run are written to this file
+static const char *trace_path;
+#ifdef SORT_INSTRUMENT
+// a buffer per worker, the output stage records into the last one
+static trace_buffer *traces;
+#endif
+
+// a file and what the coroutine sorting it spent on it
+typedef struct sort_task
+{
+    char *filename;
+    array_struct *res_arr;
+    run_list *runs;           // the external-memory mode result
+    int id;
+    coro_struct *coro;
+    long long phase_time[PHASE_COUNT]; // us
+    long long phase_mark;     // running time up to the end of the last phase, us
+#ifdef SORT_INSTRUMENT
+    long long bytes_read, bytes_written; // by the requests of the coroutine
+    long long allocations, allocated_bytes; // arena allocations and their bytes
+    long long phase_start;    // us, CLOCK_MONOTONIC, when the current phase began
+#endif
+} sort_task;
+
+static sort_task *tasks;
+static coro_sched scheduler;
+static int files_count, workers_count = 1;
+// threads the final merge of the in-memory mode is split between, -j as
+// given, workers_count is capped by the number of files
+static int merge_threads_count = 1;
+// how many coroutines a worker interleaves at once
+static int worker_active_limit;
+// input files are parsed right from their mappings instead of being read
+static int use_mmap;
+// POSIX AIO is used for reading even if io_uring is available
+static int use_aio;
+// files are sorted with LSD radix sort instead of merge sort
+static int use_radix;
+// files are always sorted with the natural merge sort, not only presorted ones
+static int use_natural;
+// files are sorted in runs as they are read, the runs are merged at the end
+static int use_pipeline;
+// files are partitioned into buckets of keys which are sorted one each, see
+// sample_sort_file()
+static int use_sample_sort;
+// result.txt is written in the binary format instead of text
+static int binary_output;
+
+// what the files hold, chosen with --type
+typedef enum elem_type
+{
+    ELEM_INT32,
+    ELEM_INT64,
+    ELEM_RECORD, // sort_record, "key payload" in the text format
+} elem_type;
+
+static const char *elem_type_names[] = {"int32", "int64", "record"};
+static elem_type element_type = ELEM_INT32;
+static size_t elem_size = sizeof(int);
+// numbers of the text format per element
+static size_t elem_numbers = 1;
+// bytes the sort may use, 0 if every file is sorted in memory as a whole,
+// otherwise files are sorted in runs which are spilled to temp_dir
+static size_t memory_limit;
+static const char *temp_dir;
+// the external-memory mode: the part of memory_limit left for the buffers
+// of the sort and the merge
+static size_t memory_budget;
+// the external-memory mode: bytes every coroutine may use
+static size_t coro_memory;
+
+// usable bytes of a coroutine stack, pages are committed on first touch
+static size_t stack_size = 32 * 1024;
+
+// scheduling policy: each of N coroutines gets T / N us of CPU before a switch
+static long long quantum; // us
+
+static long long get_time_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// the task of the running coroutine
+static sort_task* current_task()
+{
+    return coro_current()->arg;
+}
+
+// charges the running time of the current coroutine since the end of the
+// previous phase to phase
+static void coro_account_phase(coro_phase phase)
+{
+    sort_task *task = current_task();
+    long long run_time = coro_run_time();
+    task->phase_time[phase] += run_time - task->phase_mark;
+    task->phase_mark = run_time;
+    // the trace shows a phase from its beginning to its end, the slices
+    // of the other coroutines in between included
+    INSTRUMENT(
+        long long now = get_time_us();
+        if (trace_path)
+            trace_add_event(&traces[coro_current()->worker->id], coro_phase_names[phase], -1,
+                            "phase", 1, task->id, task->phase_start, now - task->phase_start);
+        task->phase_start = now;
+    )
+}
+
+#ifdef SORT_INSTRUMENT
+// the slice hook of the runtime, records the slice into the worker's buffer
+static void trace_slice(void *arg, int worker, int coro_id, const char *reason,
+                        long long start, long long duration)
+{
+    trace_buffer *worker_traces = arg;
+    trace_add_event(&worker_traces[worker], "coroutine", coro_id, reason, 0, worker,
+                    start, duration);
+}
+
+// counts the allocations the current coroutine made from the arena
+static void coro_count_arena(const arena *arena)
+{
+    sort_task *task = current_task();
+    task->allocations += arena->allocations;
+    task->allocated_bytes += arena->allocated_bytes;
+}
+#endif
 
-#define coro_yield() ({						\
-    int old_i = curr_coro_i;    									\
-    curr_coro_i = (curr_coro_i + 1) % files_count;					\
-    if (!coros[old_i].is_finished)                                             \
-        coros[old_i].total_time += clock() - coros[old_i].last_timestamp; \
-    if (!coros[curr_coro_i].is_finished)                                        \
-        coros[curr_coro_i].last_timestamp = clock();          			 \
-    swapcontext(&coros[old_i].context, &coros[curr_coro_i].context); 		\
-})
+#define SORT_KERNEL_CHECKPOINT(n) coro_check_quantum_n(n)
+#include "sort_kernels.h"
 
-#define coro_mark_finished() ({ \
-    coros[curr_coro_i].total_time += clock() - coros[curr_coro_i].last_timestamp; \
-    coros[curr_coro_i].is_finished = 1; \
-})
+static ssize_t coro_pread(int fd, void *buf, size_t count, off_t offset)
+{
+    ssize_t bytes = coro_io(fd, buf, count, offset, 0);
+    INSTRUMENT(current_task()->bytes_read += bytes > 0 ? bytes : 0;)
+    return bytes;
+}
 
-// subroutine for 'void merge_sort(int*, size_t)'
-static void merge(int *array, size_t size)
+static ssize_t coro_pwrite(int fd, const void *buf, size_t count, off_t offset)
 {
-    int *p_left = array, *p_right = array + size / 2;
-    coro_yield();
+    ssize_t bytes = coro_io(fd, (void *)buf, count, offset, 1);
+    INSTRUMENT(current_task()->bytes_written += bytes > 0 ? bytes : 0;)
+    return bytes;
+}
 
-    int *tmp_res = malloc(size * sizeof(int));
-    coro_yield();
-    int *p_tmp = tmp_res;
-    coro_yield();
+#define READ_CHUNK_SIZE (1 << 20)
 
-    while (p_left < array + size / 2 && p_right < array + size) {
-        *p_tmp++ = *p_left <= *p_right ? *p_left++ : *p_right++;
-        coro_yield();
+// reads count bytes of fd at offset into buf in chunks, returns how many
+// were read before the end of the file
+static size_t coro_pread_full(int fd, void *buf, size_t count, off_t offset, const char *filename)
+{
+    size_t done = 0;
+    while (done < count) {
+        size_t chunk = count - done < READ_CHUNK_SIZE ? count - done : READ_CHUNK_SIZE;
+        ssize_t read_bytes = coro_pread(fd, (char *)buf + done, chunk, offset + done);
+        if (read_bytes < 0) {
+            perror(filename);
+            exit(1);
+        }
+        if (!read_bytes)
+            break;
+        done += read_bytes;
     }
-    while (p_left < array + size / 2) {
-        *p_tmp++ = *p_left++;
-        coro_yield();
+    return done;
+}
+
+// Elements of a file being loaded: int32 numbers are parsed into ints with
+// the SIMD tokenizer, 64-bit ones into words, a record takes two words.
+// Only the vector of the element type is used. The vector is in an arena,
+// its capacity is allocated once and it never grows.
+typedef struct elem_vector
+{
+    int_vector ints;
+    int64_vector words;
+} elem_vector;
+
+static void* elem_vector_data(const elem_vector *vec)
+{
+    return element_type == ELEM_INT32 ? (void *)vec->ints.data : (void *)vec->words.data;
+}
+
+// an empty vector of capacity elements
+static void elem_vector_alloc(elem_vector *vec, arena *arena, size_t capacity)
+{
+    memset(vec, 0, sizeof(*vec));
+    void *data = arena_alloc(arena, capacity * elem_size);
+    if (element_type == ELEM_INT32) {
+        vec->ints.data = data;
+        vec->ints.capacity = capacity;
+    } else {
+        vec->words.data = data;
+        vec->words.capacity = capacity * elem_numbers;
     }
-    while (p_right < array + size) {
-        *p_tmp++ = *p_right++;
-        coro_yield();
+}
+
+static void elem_vector_set_size(elem_vector *vec, size_t size)
+{
+    if (element_type == ELEM_INT32)
+        vec->ints.size = size;
+    else
+        vec->words.size = size * elem_numbers;
+}
+
+// the number of whole elements parsed so far
+static size_t elem_vector_count(const elem_vector *vec)
+{
+    return element_type == ELEM_INT32 ? vec->ints.size : vec->words.size / elem_numbers;
+}
+
+// returns the number of whole elements, a key without its payload at the
+// end of the text is dropped
+static size_t elem_vector_size(elem_vector *vec, const char *filename)
+{
+    if (element_type == ELEM_INT32)
+        return vec->ints.size;
+    if (vec->words.size % elem_numbers) {
+        fprintf(stderr, "%s: the last record has no payload, it is ignored\n", filename);
+        vec->words.size -= vec->words.size % elem_numbers;
     }
+    return vec->words.size / elem_numbers;
+}
 
-    memcpy(array, tmp_res, size * sizeof(int));
-    coro_yield();
-    free(tmp_res);
+// parse_ints() of the numbers of the element type, no more than the vector
+// has room for, so that the parser never has to grow it
+static size_t elem_vector_parse(elem_vector *vec, const char **pos, const char *end,
+                                size_t max_count)
+{
+    if (element_type == ELEM_INT32) {
+        size_t room = vec->ints.capacity - vec->ints.size;
+        return parse_ints(pos, end, &vec->ints, max_count < room ? max_count : room);
+    }
+    size_t room = vec->words.capacity - vec->words.size;
+    return parse_int64s(pos, end, &vec->words, max_count < room ? max_count : room);
+}
+
+// the most elements a text of size bytes may hold, a number and the space
+// after it take two bytes at least
+static size_t text_max_elems(size_t size)
+{
+    return (size / 2 + 2) / elem_numbers + 1;
+}
+
+// validates the header of a binary file, returns the number of elements in it
+static size_t binary_input_count(const binary_header *header, size_t file_size, const char *filename)
+{
+    if (header->version != BINARY_VERSION) {
+        fprintf(stderr, "%s: binary format version %d, only version %d is supported\n", filename,
+                header->version, BINARY_VERSION);
+        exit(1);
+    }
+    if (header->elem_size != elem_size) {
+        fprintf(stderr, "%s: %d-byte elements, --type %s needs %zu-byte ones\n", filename,
+                header->elem_size, elem_type_names[element_type], elem_size);
+        exit(1);
+    }
+    size_t count = binary_le64(header->count);
+    if (count > (file_size - sizeof(*header)) / elem_size) {
+        fprintf(stderr, "%s: the file is truncated\n", filename);
+        exit(1);
+    }
+    return count;
+}
+
+// reads the header of the file, returns 0 if the file is text, otherwise
+// the number of elements following the header is stored in count
+static int read_binary_header(int fd, size_t file_size, const char *filename, size_t *count)
+{
+    binary_header header;
+    if (coro_pread_full(fd, &header, sizeof(header), 0, filename) < sizeof(header) ||
+        !binary_header_check(&header, sizeof(header)))
+        return 0;
+    *count = binary_input_count(&header, file_size, filename);
+    return 1;
 }
 
-// sorts the array using "Merge sort" algorithm
-static void merge_sort(int *array, size_t size)
+// loads all the elements of a binary file, no parsing involved,
+// returns 0 if the file is text
+static int read_binary_file(int fd, size_t file_size, const char *filename, arena *arena,
+                            elem_vector *elems)
 {
-    if (size <= 1)
+    size_t count;
+    int is_binary = read_binary_header(fd, file_size, filename, &count);
+    if (is_binary) {
+        elem_vector_alloc(elems, arena, count);
+        if (coro_pread_full(fd, elem_vector_data(elems), count * elem_size, sizeof(binary_header),
+                            filename) < count * elem_size) {
+            fprintf(stderr, "%s: the file is truncated\n", filename);
+            exit(1);
+        }
+        binary_swap_elems(elem_vector_data(elems), count, elem_size);
+        elem_vector_set_size(elems, count);
+    }
+    return is_binary;
+}
+
+// returns the file contents, its size is stored in size
+static char* read_file_async(int fd, size_t file_size, const char *filename, arena *arena,
+                             size_t *size)
+{
+    // the buffer is sized from the file, one spare byte lets the read hitting
+    // the end of file go without growing it, one more is for the trailing zero
+    size_t capacity = file_size + 1;
+    char *res_str = arena_alloc(arena, capacity + 1);
+    size_t offset = 0;
+    while (1) {
+        if (offset == capacity) { // the file has grown since fstat()
+            char *grown = arena_alloc(arena, 2 * capacity + 1);
+            memcpy(grown, res_str, offset);
+            arena_discard(res_str, capacity + 1);
+            res_str = grown;
+            capacity *= 2;
+        }
+
+        size_t count = capacity - offset < READ_CHUNK_SIZE ? capacity - offset : READ_CHUNK_SIZE;
+        ssize_t read_bytes = coro_pread(fd, res_str + offset, count, offset);
+        if (read_bytes < 0) {
+            perror(filename);
+            exit(1);
+        }
+        if (!read_bytes) // end of file
+            break;
+        offset += read_bytes;
+    }
+
+    res_str[offset] = 0;
+    *size = offset;
+    return res_str;
+}
+
+// maps the whole file of size bytes read-only, NULL is returned for an
+// empty file
+static char* map_file(int fd, size_t size, const char *filename)
+{
+    char *data = NULL;
+    if (size) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror(filename);
+            exit(1);
+        }
+        // the file is parsed front to back once, so read ahead aggressively
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    return data;
+}
+
+// opens the file, its size is stored in size
+static int open_input(const char *filename, size_t *size)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(filename);
+        exit(1);
+    }
+    *size = st.st_size;
+    return fd;
+}
+
+// how many numbers are parsed between two quantum checks
+#define PARSE_BATCH 1024
+
+// Input of the external-memory mode: the file is read through a buffer of
+// chunk_size bytes, so that memory use doesn't depend on the file size.
+typedef struct input_stream
+{
+    char *filename;
+    int fd;
+    char *buf;
+    size_t chunk_size;
+    size_t pos, len;    // buf[pos, len) is read but not parsed yet
+    off_t offset;       // file offset of buf[0]
+    int eof;
+    int binary;         // a binary file is read into the runs directly
+    size_t binary_left; // elements of a binary file not read yet
+} input_stream;
+
+// the stream reads the open fd of file_size bytes through buf
+static void input_stream_open(input_stream *in, char *filename, int fd, size_t file_size,
+                              char *buf, size_t chunk_size)
+{
+    in->filename = filename;
+    in->fd = fd;
+    in->buf = buf;
+    in->chunk_size = chunk_size;
+    in->pos = in->len = 0;
+    in->offset = 0;
+    in->eof = 0;
+    in->binary = read_binary_header(in->fd, file_size, filename, &in->binary_left);
+    if (in->binary)
+        in->offset = sizeof(binary_header);
+}
+
+static void input_stream_close(input_stream *in)
+{
+    close(in->fd);
+}
+
+// moves the unparsed tail to the front of the buffer and reads more after it
+static void input_stream_read(input_stream *in)
+{
+    memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+    in->offset += in->pos;
+    in->len -= in->pos;
+    in->pos = 0;
+    if (in->len == in->chunk_size) { // a token longer than the buffer is not a number anyway
+        in->eof = 1;
         return;
-    coro_yield();
-
-    merge_sort(array, size / 2);
-    coro_yield();
-    merge_sort(array + size / 2, size - size / 2);
-    coro_yield();
-    merge(array, size);
-}
-
-#define CHUNK_SIZE 1024
-
-static char* read_file_async(char *filename)
-{
-    struct aiocb control_block;
-    coro_yield();
-    char *res_str = malloc(CHUNK_SIZE);
-    coro_yield();
-    control_block.aio_fildes = open(filename, O_RDONLY);
-    coro_yield();
-    control_block.aio_buf = res_str;
-    coro_yield();
-    control_block.aio_offset = 0;
-    coro_yield();
-    control_block.aio_reqprio = 0;
-    coro_yield();
-    control_block.aio_sigevent.sigev_notify = SIGEV_NONE;
-    coro_yield();
-    control_block.aio_nbytes = CHUNK_SIZE;
-    coro_yield();
-
-    aio_read(&control_block);
-    coro_yield();
+    }
 
+    coro_account_phase(PHASE_PARSE);
+    ssize_t read_bytes = coro_pread(in->fd, in->buf + in->len, in->chunk_size - in->len,
+                                    in->offset + in->len);
+    coro_account_phase(PHASE_READ);
+    if (read_bytes < 0) {
+        perror(in->filename);
+        exit(1);
+    }
+    if (!read_bytes)
+        in->eof = 1;
+    in->len += read_bytes;
+}
+
+// parses up to max_count numbers of the stream into elems,
+// returns 0 at the end of the file or at an invalid number
+static size_t input_stream_parse(input_stream *in, elem_vector *elems, size_t max_count)
+{
     while (1) {
-        while (aio_error(&control_block)) // waiting for the request to finish
-            coro_yield();
-
-        int read_bytes = aio_return(&control_block);
-        coro_yield();
-        if (!read_bytes) { // end of file
-            res_str = realloc(res_str, control_block.aio_offset + 1);
-            coro_yield();
-            res_str[control_block.aio_offset] = 0;
-            coro_yield();
-            close(control_block.aio_fildes);
-            coro_yield();
-            return res_str;
+        // a number cut by the end of the buffer is left for the next read
+        size_t limit = in->len;
+        if (!in->eof)
+            while (limit > in->pos && !isspace((unsigned char)in->buf[limit - 1]))
+                --limit;
+
+        const char *p = in->buf + in->pos;
+        size_t parsed = elem_vector_parse(elems, &p, in->buf + limit, max_count);
+        in->pos = p - in->buf;
+        if (parsed || in->eof || in->pos != limit)
+            return parsed;
+        input_stream_read(in);
+    }
+}
+
+// fills elems with the next max_count elements of the stream at most,
+// returns 0 at the end of the file or at an invalid number
+static size_t input_stream_next_run(input_stream *in, elem_vector *elems, size_t max_count)
+{
+    elem_vector_set_size(elems, 0);
+    if (in->binary) {
+        size_t count = in->binary_left < max_count ? in->binary_left : max_count;
+        if (coro_pread_full(in->fd, elem_vector_data(elems), count * elem_size, in->offset,
+                            in->filename) < count * elem_size) {
+            fprintf(stderr, "%s: the file is truncated\n", in->filename);
+            exit(1);
         }
+        binary_swap_elems(elem_vector_data(elems), count, elem_size);
+        elem_vector_set_size(elems, count);
+        in->binary_left -= count;
+        in->offset += count * elem_size;
+        coro_account_phase(PHASE_READ);
+        return count;
+    }
+
+    // a record may be split between two parse calls, but not between runs
+    size_t numbers = 0, max_numbers = max_count * elem_numbers;
+    while (numbers < max_numbers) {
+        size_t batch = max_numbers - numbers < PARSE_BATCH ? max_numbers - numbers : PARSE_BATCH;
+        size_t parsed = input_stream_parse(in, elems, batch);
+        coro_check_quantum_n(parsed + 1);
+        if (!parsed)
+            break;
+        numbers += parsed;
+    }
+    coro_account_phase(PHASE_PARSE);
+    return elem_vector_size(elems, in->filename);
+}
 
-        control_block.aio_offset += read_bytes;
-        coro_yield();
-        control_block.aio_nbytes = CHUNK_SIZE - control_block.aio_offset % CHUNK_SIZE;
-        coro_yield();
 
-        if (control_block.aio_offset % CHUNK_SIZE == 0)
-            res_str = realloc(res_str, control_block.aio_offset + CHUNK_SIZE);
-        coro_yield();
-        control_block.aio_buf = res_str + control_block.aio_offset;
-        coro_yield();
+// the key of the element at p, the key of a record is its first field
+static inline int64_t elem_key(const char *p)
+{
+    if (element_type == ELEM_INT32)
+        return *(const int *)p;
+    return *(const int64_t *)p;
+}
+
+// the average run length from which the natural merge sort is used: it
+// beats merge sort from about 5 elements and radix sort from about 13
+#define NATURAL_MIN_RUN 8
+#define NATURAL_MIN_RUN_RADIX 16
+
+// sorts with the kernel of the element type chosen on the command line,
+// an input made of long sorted runs is merged along them instead, tmp has
+// room for size elements
+static void sort_elems(void *data, void *tmp, size_t size)
+{
+    size_t min_run = use_radix ? NATURAL_MIN_RUN_RADIX : NATURAL_MIN_RUN;
+    switch (element_type) {
+        case ELEM_INT32:
+            if (use_natural || presorted_i32(data, size, min_run))
+                natural_sort_i32(data, tmp, size);
+            else if (use_radix)
+                radix_sort_i32(data, tmp, size);
+            else
+                merge_sort_i32(data, tmp, size);
+            break;
+        case ELEM_INT64:
+            if (use_natural || presorted_i64(data, size, min_run))
+                natural_sort_i64(data, tmp, size);
+            else if (use_radix)
+                radix_sort_i64(data, tmp, size);
+            else
+                merge_sort_i64(data, tmp, size);
+            break;
+        case ELEM_RECORD:
+            if (use_natural || presorted_rec(data, size, min_run))
+                natural_sort_rec(data, tmp, size);
+            else if (use_radix)
+                radix_sort_rec(data, tmp, size);
+            else
+                merge_sort_rec(data, tmp, size);
+            break;
+    }
+}
+
+// merges the sorted runs of width elements, returns data or tmp, whichever
+// the result ends up in
+static void* merge_elem_runs(void *data, void *tmp, size_t size, size_t width)
+{
+    switch (element_type) {
+        case ELEM_INT32:
+            return merge_passes_i32(data, tmp, size, width);
+        case ELEM_INT64:
+            return merge_passes_i64(data, tmp, size, width);
+        case ELEM_RECORD:
+            return merge_passes_rec(data, tmp, size, width);
+    }
+    return data;
+}
+
+// how many elements are copied out of a mapped binary file between two quantum checks
+#define COPY_BATCH (64 * 1024)
+
+// parses the numbers of [*pos, end) into elems in batches to keep the
+// quantum, *pos is left at the first byte which is not a number
+static void parse_batches(const char **pos, const char *end, elem_vector *elems)
+{
+    size_t parsed;
+    do {
+        parsed = elem_vector_parse(elems, pos, end, PARSE_BATCH);
+        coro_check_quantum_n(parsed + 1);
+    } while (parsed == PARSE_BATCH);
+}
+
+// parses the numbers of a text file loaded at data
+static void parse_text(const char *data, size_t size, const char *filename, arena *arena,
+                       elem_vector *elems)
+{
+    // one pass over the text into room for as many elements as it may hold:
+    // the pages past the last one parsed are never touched, so they cost
+    // address space only
+    const char *pos = data, *end = data + size;
+    elem_vector_alloc(elems, arena, text_max_elems(size));
+    parse_batches(&pos, end, elems);
+
+    if (pos != end)
+        fprintf(stderr, "%s: invalid number at offset %zu, the rest is ignored\n",
+                filename, (size_t)(pos - data));
+}
+
+// copies the elements of a binary file mapped at data
+static void copy_binary(const char *data, size_t size, const char *filename, arena *arena,
+                        elem_vector *elems)
+{
+    size_t count = binary_input_count((const binary_header *)data, size, filename);
+    elem_vector_alloc(elems, arena, count);
+    const char *src = data + sizeof(binary_header);
+    char *dst = elem_vector_data(elems);
+    for (size_t i = 0; i < count; i += COPY_BATCH) {
+        size_t batch = count - i < COPY_BATCH ? count - i : COPY_BATCH;
+        memcpy(dst + i * elem_size, src + i * elem_size, batch * elem_size);
+        coro_check_quantum_n(batch);
+    }
+    binary_swap_elems(dst, count, elem_size);
+    elem_vector_set_size(elems, count);
+}
+
+// the pipelined mode: elements sorted at once as they arrive, the runs are
+// merged once the whole file is in
+#define PIPELINE_RUN_SIZE (64 * 1024)
+// the longest number cut by the end of a chunk, longer tokens aren't numbers
+#define PIPELINE_CARRY 64
+
+// the pipelined mode: sorts the runs among the count elements that have
+// arrived after the sorted ones, the last shorter run once the file is in
+static void sort_arrived_runs(char *data, void *tmp, size_t *sorted, size_t count, int is_last)
+{
+    while (count - *sorted >= PIPELINE_RUN_SIZE || (is_last && *sorted < count)) {
+        size_t run = count - *sorted < PIPELINE_RUN_SIZE ? count - *sorted : PIPELINE_RUN_SIZE;
+        sort_elems(data + *sorted * elem_size, tmp, run);
+        *sorted += run;
+    }
+}
+
+// the pipelined mode for a binary file of count elements: they are read
+// straight into the vector, a chunk in flight while the last one is sorted
+static void read_binary_pipelined(int fd, const char *filename, size_t count, void *tmp,
+                                  elem_vector *elems)
+{
+    char *data = elem_vector_data(elems);
+    size_t total = count * elem_size, done = 0, swapped = 0, sorted = 0;
+    io_request request;
+    coro_io_start(&request, fd, data, total < READ_CHUNK_SIZE ? total : READ_CHUNK_SIZE,
+                  sizeof(binary_header), 0);
+    while (done < total) {
+        ssize_t read_bytes = coro_io_wait(&request);
+        if (read_bytes < 0) {
+            perror(filename);
+            exit(1);
+        }
+        if (!read_bytes) {
+            fprintf(stderr, "%s: the file is truncated\n", filename);
+            exit(1);
+        }
+        INSTRUMENT(current_task()->bytes_read += read_bytes;)
+        done += read_bytes;
+        if (done < total)
+            coro_io_start(&request, fd, data + done,
+                          total - done < READ_CHUNK_SIZE ? total - done : READ_CHUNK_SIZE,
+                          sizeof(binary_header) + done, 0);
+        coro_account_phase(PHASE_READ);
+
+        // an element cut by the end of the chunk waits for the rest of it
+        size_t arrived = done / elem_size;
+        binary_swap_elems(data + swapped * elem_size, arrived - swapped, elem_size);
+        swapped = arrived;
+        coro_account_phase(PHASE_PARSE);
+        sort_arrived_runs(data, tmp, &sorted, arrived, done == total);
+        coro_account_phase(PHASE_SORT);
+    }
+    elem_vector_set_size(elems, count);
+}
+
+// the pipelined mode for a text file: it is read in chunks through two
+// buffers, the next chunk is in flight while the last one is parsed and its
+// runs are sorted
+static void read_text_pipelined(int fd, const char *filename, arena *arena, void *tmp,
+                                elem_vector *elems)
+{
+    char *bufs[2];
+    for (int i = 0; i < 2; ++i)
+        bufs[i] = arena_alloc(arena, PIPELINE_CARRY + READ_CHUNK_SIZE);
+    io_request request;
+    coro_io_start(&request, fd, bufs[0] + PIPELINE_CARRY, READ_CHUNK_SIZE, 0, 0);
+    off_t offset = 0;     // of the chunk in flight
+    size_t carry = 0;     // bytes of a number cut by the end of the last chunk
+    size_t sorted = 0;
+    for (int cur = 0; ; cur = !cur) {
+        ssize_t read_bytes = coro_io_wait(&request);
+        if (read_bytes < 0) {
+            perror(filename);
+            exit(1);
+        }
+        INSTRUMENT(current_task()->bytes_read += read_bytes;)
+        int eof = !read_bytes;
+        offset += read_bytes;
+        if (!eof)
+            coro_io_start(&request, fd, bufs[!cur] + PIPELINE_CARRY, READ_CHUNK_SIZE, offset, 0);
+        coro_account_phase(PHASE_READ);
+
+        // the cut number is completed by the chunk, the one cut by its end
+        // is left for the next
+        const char *data = bufs[cur] + PIPELINE_CARRY - carry, *pos = data;
+        const char *end = bufs[cur] + PIPELINE_CARRY + read_bytes, *limit = end;
+        off_t data_offset = offset - read_bytes - carry;
+        if (!eof)
+            while (limit > pos && !isspace((unsigned char)limit[-1]))
+                --limit;
+        parse_batches(&pos, limit, elems);
+        coro_account_phase(PHASE_PARSE);
+
+        carry = end - pos;
+        if (pos != limit || carry > PIPELINE_CARRY) {
+            fprintf(stderr, "%s: invalid number at offset %lld, the rest is ignored\n",
+                    filename, (long long)(data_offset + (pos - data)));
+            eof = 1;
+        }
+        sort_arrived_runs(elem_vector_data(elems), tmp, &sorted, elem_vector_count(elems), eof);
+        coro_account_phase(PHASE_SORT);
+        if (eof)
+            break;
+        memcpy(bufs[!cur] + PIPELINE_CARRY - carry, pos, carry);
+    }
+    // a request may still be in flight after an invalid number
+    if (!request.is_done)
+        coro_io_wait(&request);
+}
+
+// the pipelined mode: the file is read, parsed and sorted in runs at once,
+// the sorted elements are stored in res_arr
+static void sort_file_pipelined(int fd, size_t file_size, const char *filename, arena *arena,
+                                array_struct *res_arr)
+{
+    elem_vector elems;
+    size_t count;
+    if (read_binary_header(fd, file_size, filename, &count)) {
+        elem_vector_alloc(&elems, arena, count);
+        void *tmp = arena_alloc(arena, count * elem_size);
+        read_binary_pipelined(fd, filename, count, tmp, &elems);
+        res_arr->data = merge_elem_runs(elem_vector_data(&elems), tmp, count, PIPELINE_RUN_SIZE);
+    } else {
+        // the scratch buffer is as large as the elements may get, the pages
+        // past those the file has are never touched
+        elem_vector_alloc(&elems, arena, text_max_elems(file_size));
+        void *tmp = arena_alloc(arena, text_max_elems(file_size) * elem_size);
+        read_text_pipelined(fd, filename, arena, tmp, &elems);
+        count = elem_vector_size(&elems, filename);
+        res_arr->data = merge_elem_runs(elem_vector_data(&elems), tmp, count, PIPELINE_RUN_SIZE);
+    }
+    res_arr->size = count;
+    coro_account_phase(PHASE_SORT);
+}
+
+// the arena of a file of size bytes in memory: room for the text, or the
+// buffers of the pipelined mode, for the elements it may hold and for the
+// scratch buffer of the sort
+static size_t sort_arena_size(size_t size)
+{
+    size_t text = use_pipeline ? 2 * (PIPELINE_CARRY + READ_CHUNK_SIZE) : size + 2;
+    return text + 2 * text_max_elems(size) * elem_size + 4 * 64;
+}
 
-        aio_read(&control_block);
-        coro_yield();
+// reads and parses the file into elems, returns their number, every
+// buffer of the file comes from its arena, which is sized from the file
+static size_t load_file(char *filename, arena *arena, elem_vector *elems)
+{
+    size_t file_size, size;
+    int fd = open_input(filename, &file_size);
+    arena_init(arena, sort_arena_size(file_size));
+    if (use_mmap) {
+        // the pages are read in as the parser touches them
+        char *data = map_file(fd, file_size, filename);
+        size = file_size;
+        INSTRUMENT(current_task()->bytes_read += size;)
+        coro_account_phase(PHASE_READ);
+        if (binary_header_check(data, size))
+            copy_binary(data, size, filename, arena, elems);
+        else
+            parse_text(data, size, filename, arena, elems);
+        if (size)
+            munmap(data, size);
+        coro_account_phase(PHASE_PARSE);
+    } else if (read_binary_file(fd, file_size, filename, arena, elems)) {
+        coro_account_phase(PHASE_READ);
+    } else {
+        char *text = read_file_async(fd, file_size, filename, arena, &size);
+        coro_account_phase(PHASE_READ);
+        parse_text(text, size, filename, arena, elems);
+        arena_discard(text, size + 2);
+        coro_account_phase(PHASE_PARSE);
     }
+    close(fd);
+    return elem_vector_size(elems, filename);
 }
 
-// loads numbers from the file into memory and sorts them
-// result is in res_arr after return
+// the arena of res_arr is freed once the elements are merged
 static void sort_file(char* filename, array_struct *res_arr)
 {
-    static int jobs_running = 0;
-    jobs_running++;
-    coro_yield();
+    arena *arena = &res_arr->arena;
+    if (use_pipeline) {
+        size_t file_size;
+        int fd = open_input(filename, &file_size);
+        arena_init(arena, sort_arena_size(file_size));
+        sort_file_pipelined(fd, file_size, filename, arena, res_arr);
+        close(fd);
+        INSTRUMENT(coro_count_arena(arena);)
+        return;
+    }
+
+    elem_vector elems;
+    size_t count = load_file(filename, arena, &elems);
+
+    // the only scratch buffer the sort needs
+    void *tmp = arena_alloc(arena, count * elem_size);
+    sort_elems(elem_vector_data(&elems), tmp, count);
+    arena_discard(tmp, count * elem_size);
+    coro_account_phase(PHASE_SORT);
+    INSTRUMENT(coro_count_arena(arena);)
+
+    res_arr->data = elem_vector_data(&elems);
+    res_arr->size = count;
+}
+
+// --sample-sort: splitters chosen from samples of all the files cut the
+// keys into as many buckets as there are files, up to SAMPLE_MAX_BUCKETS.
+// The buckets are laid out one after another in a single array. Every
+// coroutine moves the elements of its file into their buckets and then
+// sorts one bucket, after which the array is sorted as a whole and is
+// written out without merging the files.
+#define SAMPLE_MAX_BUCKETS 1024
+// samples drawn from a file, each weighs the file size / their number
+#define SAMPLES_PER_FILE 256
+// elements classified or moved between two quantum checks
+#define PARTITION_BATCH 4096
+
+typedef struct sample_sort
+{
+    coro_barrier barrier;  // all the coroutines meet between the steps
+    int buckets;
+    sort_record *samples;  // key and file, SAMPLES_PER_FILE slots of every file
+    size_t *sample_counts; // drawn from every file
+    size_t *sizes;         // elements of every file
+    int64_t *splitters;    // buckets - 1, a key goes after the splitters not greater than it
+    // [file][bucket]: elements of the file in the bucket, then where in
+    // result the next one of them goes
+    size_t *offsets;
+    size_t *bucket_starts; // buckets + 1 elements of result
+    arena arena;           // result and its scratch buffer
+    void *result, *tmp;
+    size_t total;          // elements
+} sample_sort;
 
-    char *file_string = read_file_async(filename);
-    coro_yield();
-    FILE *file_string_stream = fmemopen(file_string, strlen(file_string), "r");
-    coro_yield();
+static sample_sort sampler;
 
-    size_t ints_count = 0, dummy;
-    coro_yield();
-    while (fscanf(file_string_stream, "%ld", &dummy) == 1) {
-        ++ints_count;
-        coro_yield();
+static void sample_sort_init(int files)
+{
+    sampler.buckets = files < SAMPLE_MAX_BUCKETS ? files : SAMPLE_MAX_BUCKETS;
+    coro_barrier_init(&sampler.barrier, files);
+    sampler.samples = malloc(files * SAMPLES_PER_FILE * sizeof(sort_record));
+    sampler.sample_counts = malloc(files * sizeof(size_t));
+    sampler.sizes = malloc(files * sizeof(size_t));
+    sampler.splitters = malloc(sampler.buckets * sizeof(int64_t));
+    sampler.offsets = calloc((size_t)files * sampler.buckets, sizeof(size_t));
+    sampler.bucket_starts = malloc((sampler.buckets + 1) * sizeof(size_t));
+    if (!sampler.samples || !sampler.sample_counts || !sampler.sizes || !sampler.splitters ||
+        !sampler.offsets || !sampler.bucket_starts) {
+        perror("sample sort");
+        exit(1);
     }
+    sampler.result = sampler.tmp = NULL;
+    sampler.total = 0;
+}
 
-    int *array_to_sort = malloc(ints_count * sizeof(int));
-    coro_yield();
+// the result stays in its arena until it is freed
+static void sample_sort_free()
+{
+    coro_barrier_destroy(&sampler.barrier);
+    free(sampler.samples);
+    free(sampler.sample_counts);
+    free(sampler.sizes);
+    free(sampler.splitters);
+    free(sampler.offsets);
+    free(sampler.bucket_starts);
+}
 
-    fseek(file_string_stream, 0, SEEK_SET);
-    coro_yield();
+// draws the samples of a file at positions given by a generator seeded
+// with the file, so that runs are repeatable, a small file is taken whole
+static void draw_samples(int file, const char *data, size_t size)
+{
+    size_t count = size < SAMPLES_PER_FILE ? size : SAMPLES_PER_FILE;
+    sort_record *samples = sampler.samples + (size_t)file * SAMPLES_PER_FILE;
+    uint64_t state = 0x9e3779b97f4a7c15ULL * (file + 1);
+    for (size_t i = 0; i < count; ++i) {
+        // xorshift64
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        size_t pos = count == size ? i : state % size;
+        samples[i].key = elem_key(data + pos * elem_size);
+        samples[i].payload = file;
+    }
+    sampler.sample_counts[file] = count;
+    sampler.sizes[file] = size;
+}
 
-    for (int i = 0; i < ints_count; ++i) {
-        fscanf(file_string_stream, "%d", &array_to_sort[i]);
-        coro_yield();
+// sorts the samples of all the files and takes the splitters at equal steps
+// of their weights, a sample weighs as many elements as it stands for
+static void choose_splitters(int files)
+{
+    size_t count = 0;
+    double total = 0;
+    for (int file = 0; file < files; ++file) {
+        memmove(sampler.samples + count, sampler.samples + (size_t)file * SAMPLES_PER_FILE,
+                sampler.sample_counts[file] * sizeof(sort_record));
+        count += sampler.sample_counts[file];
+        total += sampler.sizes[file];
     }
+    sort_record *tmp = malloc((count + 1) * sizeof(sort_record));
+    merge_sort_rec(sampler.samples, tmp, count);
+    free(tmp);
 
-    fclose(file_string_stream);
-    coro_yield();
-    free(file_string);
-    coro_yield();
+    int bucket = 1;
+    double weight = 0;
+    for (size_t i = 0; i < count && bucket < sampler.buckets; ++i) {
+        int file = sampler.samples[i].payload;
+        weight += (double)sampler.sizes[file] / sampler.sample_counts[file];
+        while (bucket < sampler.buckets && weight >= total * bucket / sampler.buckets)
+            sampler.splitters[bucket++ - 1] = sampler.samples[i].key;
+    }
+    while (bucket < sampler.buckets)
+        sampler.splitters[bucket++ - 1] = INT64_MAX;
+}
 
-    merge_sort(array_to_sort, ints_count);
-    coro_yield();
+// the bucket of key: how many splitters are not greater than it
+static inline int sample_bucket(int64_t key)
+{
+    const int64_t *splitters = sampler.splitters;
+    int low = 0, high = sampler.buckets - 1;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (splitters[mid] <= key)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
 
-    res_arr->p_arr = array_to_sort;
-    coro_yield();
-    res_arr->size = ints_count;
-    coro_yield();
+// lays the buckets out one after another in the result array, the
+// elements of every file in a bucket after the ones of the files before it
+static void place_buckets(int files)
+{
+    size_t offset = 0;
+    for (int bucket = 0; bucket < sampler.buckets; ++bucket) {
+        sampler.bucket_starts[bucket] = offset;
+        for (int file = 0; file < files; ++file) {
+            size_t *slot = &sampler.offsets[(size_t)file * sampler.buckets + bucket];
+            size_t count = *slot;
+            *slot = offset;
+            offset += count;
+        }
+    }
+    sampler.bucket_starts[sampler.buckets] = offset;
+    sampler.total = offset;
 
-    coro_mark_finished();
+    arena_init(&sampler.arena, 2 * offset * elem_size + 2 * 64);
+    sampler.result = arena_alloc(&sampler.arena, offset * elem_size);
+    sampler.tmp = arena_alloc(&sampler.arena, offset * elem_size);
+}
+
+// copies the elements [begin, end) of data to their places in result, size
+// is elem_size, a constant where this is inlined
+static inline void scatter_elems(const char *data, size_t begin, size_t end,
+                                 const uint16_t *buckets, size_t *offsets, size_t size)
+{
+    char *result = sampler.result;
+    for (size_t i = begin; i < end; ++i)
+        memcpy(result + offsets[buckets[i]]++ * size, data + i * size, size);
+}
 
-    printf("Coro %d finished sorting\n", curr_coro_i);
-    coro_yield();
-    jobs_running--;
-    coro_yield();
+static void sample_sort_file(sort_task *task)
+{
+    arena *arena = &task->res_arr->arena;
+    elem_vector elems;
+    size_t count = load_file(task->filename, arena, &elems);
+    const char *data = elem_vector_data(&elems);
+    draw_samples(task->id, data, count);
+    if (coro_barrier_wait(&sampler.barrier))
+        choose_splitters(files_count);
+    coro_barrier_wait(&sampler.barrier);
+
+    // the bucket of every element is kept for the second pass
+    uint16_t *buckets = arena_alloc(arena, count * sizeof(uint16_t));
+    size_t *offsets = sampler.offsets + (size_t)task->id * sampler.buckets;
+    for (size_t begin = 0; begin < count; begin += PARTITION_BATCH) {
+        size_t end = count - begin < PARTITION_BATCH ? count : begin + PARTITION_BATCH;
+        for (size_t i = begin; i < end; ++i) {
+            buckets[i] = sample_bucket(elem_key(data + i * elem_size));
+            offsets[buckets[i]]++;
+        }
+        coro_check_quantum_n(end - begin);
+    }
+    coro_account_phase(PHASE_PARTITION);
+    if (coro_barrier_wait(&sampler.barrier))
+        place_buckets(files_count);
+    coro_barrier_wait(&sampler.barrier);
+
+    for (size_t begin = 0; begin < count; begin += PARTITION_BATCH) {
+        size_t end = count - begin < PARTITION_BATCH ? count : begin + PARTITION_BATCH;
+        if (elem_size == sizeof(int))
+            scatter_elems(data, begin, end, buckets, offsets, sizeof(int));
+        else if (elem_size == sizeof(int64_t))
+            scatter_elems(data, begin, end, buckets, offsets, sizeof(int64_t));
+        else
+            scatter_elems(data, begin, end, buckets, offsets, sizeof(sort_record));
+        coro_check_quantum_n(end - begin);
+    }
+    // the file is all in result now
+    INSTRUMENT(coro_count_arena(arena);)
+    arena_free(arena);
+    coro_account_phase(PHASE_PARTITION);
+    coro_barrier_wait(&sampler.barrier);
 
-    while (jobs_running) // wait all coros
-        coro_yield();
+    if (task->id < sampler.buckets) {
+        size_t begin = sampler.bucket_starts[task->id];
+        size_t size = sampler.bucket_starts[task->id + 1] - begin;
+        char *tmp = (char *)sampler.tmp + begin * elem_size;
+        sort_elems((char *)sampler.result + begin * elem_size, tmp, size);
+        arena_discard(tmp, size * elem_size);
+        coro_account_phase(PHASE_SORT);
+    }
 }
 
-// merges array2 into array1 and frees array2
-static void merge_arrays(array_struct *array1, array_struct *array2)
+#define WRITE_CHUNK_SIZE (1 << 20)
+
+// creates a temporary file for spilled runs, it is deleted once closed
+static int create_spill_file()
 {
-    int *p_left = array1->p_arr;
-    int *p_right = array2->p_arr;
-    int *p_res = malloc((array1->size + array2->size) * sizeof(int));
-    int *old_p_res = p_res;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/sort-runs-XXXXXX", temp_dir);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    unlink(path);
+    return fd;
+}
 
-    while (p_left < array1->p_arr + array1->size && p_right < array2->p_arr + array2->size)
-        *p_res++ = *p_left <= *p_right ? *p_left++ : *p_right++;
-    while (p_left < array1->p_arr + array1->size)
-        *p_res++ = *p_left++;
-    while (p_right < array2->p_arr + array2->size)
-        *p_res++ = *p_right++;
+static void run_list_push(run_list *list, int fd, off_t offset, size_t size)
+{
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->runs = realloc(list->runs, list->capacity * sizeof(spilled_run));
+    }
+    spilled_run *run = &list->runs[list->count++];
+    run->fd = fd;
+    run->offset = offset;
+    run->size = size;
+}
 
-    free(array1->p_arr);
-    free(array2->p_arr);
+// closes the files of the runs, the runs of one file are adjacent
+static void close_run_files(const spilled_run *runs, int count)
+{
+    for (int i = 0; i < count; ++i)
+        if (!i || runs[i].fd != runs[i - 1].fd)
+            close(runs[i].fd);
+}
 
-    array1->p_arr = old_p_res;
-    array1->size += array2->size;
+// appends a sorted run to the end of the spill file, which is at *file_size
+static void spill_run(const void *data, size_t size, int fd, off_t *file_size, run_list *runs)
+{
+    const char *bytes = data;
+    size_t total = size * elem_size, done = 0;
+    while (done < total) {
+        size_t count = total - done < WRITE_CHUNK_SIZE ? total - done : WRITE_CHUNK_SIZE;
+        ssize_t written = coro_pwrite(fd, bytes + done, count, *file_size + done);
+        if (written <= 0) {
+            perror("spill run");
+            exit(1);
+        }
+        done += written;
+    }
+    run_list_push(runs, fd, *file_size, size);
+    *file_size += total;
 }
 
-// merges all the arrays into arrays[0] and frees others
-static void merge_arrays_list(array_struct *arrays, size_t arrays_count)
+// the external-memory mode: a quarter of a coroutine's memory at most is for
+// reading, the rest is split between a run and the scratch buffer of the sort
+static size_t external_chunk_size()
 {
-    if	(arrays_count <= 1)
+    return coro_memory / 4 < READ_CHUNK_SIZE ? coro_memory / 4 : READ_CHUNK_SIZE;
+}
+
+static size_t external_run_capacity()
+{
+    return (coro_memory - external_chunk_size()) / (2 * elem_size);
+}
+
+// the external-memory mode: sorts the file in runs as long as fit into
+// coro_memory and spills them into a temporary file, runs get all of them
+static void sort_file_external(char *filename, run_list *runs)
+{
+    size_t input_size;
+    int input_fd = open_input(filename, &input_size);
+    size_t chunk_size = external_chunk_size();
+    // a file shorter than a run needs only as much room as its elements
+    size_t run_capacity = external_run_capacity();
+    if (run_capacity > text_max_elems(input_size))
+        run_capacity = text_max_elems(input_size);
+
+    // the read buffer, the run and the scratch buffer of the sort are all
+    // of the coroutine's memory, released together once the file is spilled
+    arena arena;
+    arena_init(&arena, chunk_size + 2 * run_capacity * elem_size + 4 * 64);
+    input_stream in;
+    input_stream_open(&in, filename, input_fd, input_size, arena_alloc(&arena, chunk_size),
+                      chunk_size);
+    coro_account_phase(PHASE_READ);
+    elem_vector elems;
+    elem_vector_alloc(&elems, &arena, run_capacity);
+    void *tmp = arena_alloc(&arena, run_capacity * elem_size);
+    int fd = -1;
+    off_t file_size = 0;
+    size_t count;
+
+    while ((count = input_stream_next_run(&in, &elems, run_capacity))) {
+        sort_elems(elem_vector_data(&elems), tmp, count);
+        coro_account_phase(PHASE_SORT);
+        if (fd < 0)
+            fd = create_spill_file();
+        spill_run(elem_vector_data(&elems), count, fd, &file_size, runs);
+        coro_account_phase(PHASE_SPILL);
+    }
+
+    if (!in.binary && in.pos != in.len)
+        fprintf(stderr, "%s: invalid number at offset %lld, the rest is ignored\n",
+                filename, (long long)(in.offset + in.pos));
+    input_stream_close(&in);
+    INSTRUMENT(coro_count_arena(&arena);)
+    arena_free(&arena);
+}
+
+// sorted sequence consumed by the k-way merge
+typedef struct merge_source
+{
+    const char *cur, *end; // elements of elem_size bytes
+    int64_t key;           // of *cur, the tree compares keys of every element type alike
+    // a spilled run is streamed through buf,
+    // the part not read yet is at offset in fd
+    char *buf;
+    size_t buf_size; // elements
+    int fd;
+    off_t offset;
+    size_t left;     // elements
+} merge_source;
+
+static void pread_all(int fd, void *buf, size_t count, off_t offset)
+{
+    for (size_t done = 0; done < count;) {
+        ssize_t read_bytes = pread(fd, (char *)buf + done, count - done, offset + done);
+        if (read_bytes <= 0) {
+            perror("read spilled run");
+            exit(1);
+        }
+        done += read_bytes;
+    }
+}
+
+static void pwrite_all(int fd, const void *buf, size_t count, off_t offset)
+{
+    for (size_t done = 0; done < count;) {
+        ssize_t written = pwrite(fd, (const char *)buf + done, count - done, offset + done);
+        if (written <= 0) {
+            perror("spill run");
+            exit(1);
+        }
+        done += written;
+    }
+}
+
+// reads the next part of a spilled run into its buffer
+static void merge_source_refill(merge_source *source)
+{
+    size_t count = source->left < source->buf_size ? source->left : source->buf_size;
+    pread_all(source->fd, source->buf, count * elem_size, source->offset);
+    source->cur = source->buf;
+    source->end = source->buf + count * elem_size;
+    source->key = elem_key(source->cur);
+    source->offset += count * elem_size;
+    source->left -= count;
+}
+
+// advances the source past its head
+static inline void merge_source_next(merge_source *source)
+{
+    if ((source->cur += elem_size) != source->end)
+        source->key = elem_key(source->cur);
+    else if (source->left)
+        merge_source_refill(source);
+}
+
+// Tournament tree for the k-way merge: leaves are the sources, every inner
+// node keeps the loser of the match played in it, nodes[0] is the overall
+// winner. Taking the minimum costs one replay from a leaf to the root,
+// i.e. log2(k) comparisons, and every element is moved exactly once.
+typedef struct loser_tree
+{
+    merge_source *sources;
+    int *nodes;
+    int k;
+} loser_tree;
+
+// exhausted sources lose every match
+static int source_less(const merge_source *sources, int a, int b)
+{
+    if (sources[a].cur == sources[a].end)
+        return 0;
+    if (sources[b].cur == sources[b].end)
+        return 1;
+    return sources[a].key < sources[b].key;
+}
+
+// plays the matches of the subtree rooted at node, returns its winner
+static int loser_tree_build(loser_tree *tree, int node)
+{
+    if (node >= tree->k)
+        return node - tree->k;
+
+    int left = loser_tree_build(tree, 2 * node);
+    int right = loser_tree_build(tree, 2 * node + 1);
+    if (source_less(tree->sources, right, left)) {
+        tree->nodes[node] = left;
+        return right;
+    }
+    tree->nodes[node] = right;
+    return left;
+}
+
+static void loser_tree_init(loser_tree *tree, merge_source *sources, int k)
+{
+    tree->sources = sources;
+    tree->k = k;
+    tree->nodes = malloc(k * sizeof(int));
+    tree->nodes[0] = loser_tree_build(tree, 1);
+}
+
+// replays the matches on the path of the winner after its source advanced
+static void loser_tree_replay(loser_tree *tree)
+{
+    int winner = tree->nodes[0];
+    for (int node = (winner + tree->k) / 2; node > 0; node /= 2) {
+        if (source_less(tree->sources, tree->nodes[node], winner)) {
+            int tmp = tree->nodes[node];
+            tree->nodes[node] = winner;
+            winner = tmp;
+        }
+    }
+    tree->nodes[0] = winner;
+}
+
+static void loser_tree_free(loser_tree *tree)
+{
+    free(tree->nodes);
+}
+
+// the binary output starts with a header, text has none
+static void put_output_header(output_writer *writer, size_t total_size)
+{
+    if (binary_output) {
+        binary_header header;
+        binary_header_init(&header, elem_size, total_size);
+        output_writer_put_bytes(writer, &header, sizeof(header));
+    }
+}
+
+// appends the element at p in the output format
+static inline void put_output_elem(output_writer *writer, const char *p)
+{
+    switch (element_type) {
+        case ELEM_INT32:
+            if (binary_output)
+                output_writer_put_binary_int(writer, *(const int *)p);
+            else
+                output_writer_put_int(writer, *(const int *)p);
+            break;
+        case ELEM_INT64:
+            if (binary_output)
+                output_writer_put_binary_int64(writer, *(const int64_t *)p);
+            else
+                output_writer_put_int64(writer, *(const int64_t *)p);
+            break;
+        case ELEM_RECORD: {
+            const sort_record *record = (const sort_record *)p;
+            if (binary_output) {
+                output_writer_put_binary_int64(writer, record->key);
+                output_writer_put_binary_int64(writer, record->payload);
+            } else {
+                output_writer_put_int64(writer, record->key);
+                output_writer_put_int64(writer, record->payload);
+            }
+            break;
+        }
+    }
+}
+
+// merges total_size elements of the sources in one pass and streams the result into writer
+static void merge_sources_to_file(merge_source *sources, int count, size_t total_size,
+                                  output_writer *writer)
+{
+    if (count == 1) {
+        // nothing to merge, e.g. the sorted array of --sample-sort
+        for (size_t i = 0; i < total_size; ++i) {
+            put_output_elem(writer, sources->cur);
+            merge_source_next(sources);
+        }
+        return;
+    }
+
+    loser_tree tree;
+    loser_tree_init(&tree, sources, count);
+
+    for (size_t i = 0; i < total_size; ++i) {
+        merge_source *winner = &sources[tree.nodes[0]];
+        put_output_elem(writer, winner->cur);
+        merge_source_next(winner);
+        loser_tree_replay(&tree);
+    }
+
+    loser_tree_free(&tree);
+}
+
+// what the final merge reports
+typedef struct merge_stats
+{
+    size_t elements;
+    long long bytes_written;
+    long long write_time; // us the writer threads spent writing
+    int ranges;           // threads the merge was split between
+    int passes;           // over the spilled runs
+} merge_stats;
+
+// a source reading the elements [begin, end) of a sorted array
+static void merge_source_init_array(merge_source *source, const array_struct *array,
+                                    size_t begin, size_t end)
+{
+    source->cur = (const char *)array->data + begin * elem_size;
+    source->end = (const char *)array->data + end * elem_size;
+    source->key = begin < end ? elem_key(source->cur) : 0;
+    source->left = 0;
+}
+
+// bytes put_output_elem() appends for the element at p
+static inline size_t output_elem_len(const char *p)
+{
+    if (binary_output)
+        return elem_size;
+    switch (element_type) {
+        case ELEM_INT32:
+            return format_int_len(*(const int *)p);
+        case ELEM_INT64:
+            return format_int64_len(*(const int64_t *)p);
+        default: {
+            const sort_record *record = (const sort_record *)p;
+            return format_int64_len(record->key) + format_int64_len(record->payload);
+        }
+    }
+}
+
+// elements of the sorted array with keys less than key, or not greater
+// than key if or_equal is set
+static size_t array_rank(const array_struct *array, int64_t key, int or_equal)
+{
+    const char *data = array->data;
+    size_t low = 0, high = array->size;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int64_t mid_key = elem_key(data + mid * elem_size);
+        if (mid_key < key || (or_equal && mid_key == key))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Co-ranking: splits[i] is set to how many elements of array i come before
+// the position rank of the merged output, 0 < rank < the total size. The key
+// at rank is found by a binary search over the keys, elements with smaller
+// keys all go before it, equal ones are taken from the lower arrays first.
+static void corank(const array_struct *arrays, int count, size_t rank, size_t *splits)
+{
+    int64_t low = INT64_MAX, high = INT64_MIN;
+    for (int i = 0; i < count; ++i) {
+        if (!arrays[i].size)
+            continue;
+        int64_t first = elem_key(arrays[i].data);
+        int64_t last = elem_key((const char *)arrays[i].data + (arrays[i].size - 1) * elem_size);
+        low = first < low ? first : low;
+        high = last > high ? last : high;
+    }
+
+    // the least key with more than rank elements not greater than it
+    while (low < high) {
+        int64_t mid = (int64_t)((uint64_t)low + ((uint64_t)high - (uint64_t)low) / 2);
+        size_t not_greater = 0;
+        for (int i = 0; i < count; ++i)
+            not_greater += array_rank(&arrays[i], mid, 1);
+        if (not_greater > rank)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    size_t left = rank;
+    for (int i = 0; i < count; ++i) {
+        splits[i] = array_rank(&arrays[i], low, 0);
+        left -= splits[i];
+    }
+    for (int i = 0; i < count && left; ++i) {
+        size_t equal = array_rank(&arrays[i], low, 1) - splits[i];
+        size_t taken = equal < left ? equal : left;
+        splits[i] += taken;
+        left -= taken;
+    }
+}
+
+// the least elements a thread of the parallel merge gets, fewer aren't
+// worth starting a thread for
+#define PARALLEL_MERGE_MIN_SIZE (64 << 10)
+
+struct parallel_merge;
+
+// part of the output of the parallel merge, made of a slice of every array
+typedef struct merge_range
+{
+    struct parallel_merge *merge;
+    pthread_t thread;
+    int index;
+    const size_t *begin, *end; // the slices, in elements of every array
+    size_t size;               // elements in all the slices
+    size_t bytes;              // the length of the range in the output
+    long long bytes_written;
+    long long write_time;      // us
+} merge_range;
+
+typedef struct parallel_merge
+{
+    const array_struct *arrays;
+    int arrays_count;
+    size_t total_size;
+    merge_range *ranges;
+    int ranges_count;
+    int fd;
+    pthread_barrier_t lengths_known; // every range knows its offset after it
+} parallel_merge;
+
+// thread of the parallel merge: merges and writes its range
+static void* merge_range_run(void *arg)
+{
+    merge_range *range = arg;
+    parallel_merge *merge = range->merge;
+    int count = merge->arrays_count;
+
+    // the length of the formatted range doesn't depend on the order of its
+    // elements, so every range knows where it starts before merging
+    range->bytes = !range->index && binary_output ? sizeof(binary_header) : 0;
+    if (binary_output) {
+        range->bytes += range->size * elem_size;
+    } else {
+        for (int i = 0; i < count; ++i) {
+            const char *data = merge->arrays[i].data;
+            for (size_t j = range->begin[i]; j < range->end[i]; ++j)
+                range->bytes += output_elem_len(data + j * elem_size);
+        }
+    }
+    pthread_barrier_wait(&merge->lengths_known);
+
+    off_t offset = 0;
+    for (int i = 0; i < range->index; ++i)
+        offset += merge->ranges[i].bytes;
+
+    merge_source *sources = malloc(count * sizeof(merge_source));
+    for (int i = 0; i < count; ++i)
+        merge_source_init_array(&sources[i], &merge->arrays[i], range->begin[i], range->end[i]);
+
+    output_writer writer;
+    output_writer_open_at(&writer, merge->fd, offset);
+    if (!range->index)
+        put_output_header(&writer, merge->total_size);
+    merge_sources_to_file(sources, count, range->size, &writer);
+    output_writer_close(&writer);
+
+    range->bytes_written = writer.bytes_written;
+    range->write_time = writer.write_time;
+    free(sources);
+    return NULL;
+}
+
+// merges the arrays into fd split into stats->ranges ranges of about the
+// same size, every range is merged, formatted and written by a thread of its own
+static void merge_arrays_parallel(const array_struct *arrays, int arrays_count,
+                                  size_t total_size, int fd, merge_stats *stats)
+{
+    int ranges_count = stats->ranges;
+    parallel_merge merge;
+    merge.arrays = arrays;
+    merge.arrays_count = arrays_count;
+    merge.total_size = total_size;
+    merge.ranges_count = ranges_count;
+    merge.fd = fd;
+    merge.ranges = malloc(ranges_count * sizeof(merge_range));
+    pthread_barrier_init(&merge.lengths_known, NULL, ranges_count);
+
+    // the boundaries of range r in every array are splits[r], splits[r + 1]
+    size_t *splits = malloc((ranges_count + 1) * arrays_count * sizeof(size_t));
+    for (int i = 0; i < arrays_count; ++i) {
+        splits[i] = 0;
+        splits[ranges_count * arrays_count + i] = arrays[i].size;
+    }
+    for (int r = 1; r < ranges_count; ++r)
+        corank(arrays, arrays_count, total_size * r / ranges_count, splits + r * arrays_count);
+
+    for (int r = 0; r < ranges_count; ++r) {
+        merge_range *range = &merge.ranges[r];
+        range->merge = &merge;
+        range->index = r;
+        range->begin = splits + r * arrays_count;
+        range->end = splits + (r + 1) * arrays_count;
+        range->size = total_size * (r + 1) / ranges_count - total_size * r / ranges_count;
+        int err = pthread_create(&range->thread, NULL, merge_range_run, range);
+        if (err) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+
+    for (int r = 0; r < ranges_count; ++r) {
+        pthread_join(merge.ranges[r].thread, NULL);
+        stats->bytes_written += merge.ranges[r].bytes_written;
+        stats->write_time += merge.ranges[r].write_time;
+    }
+
+    pthread_barrier_destroy(&merge.lengths_known);
+    free(splits);
+    free(merge.ranges);
+}
+
+// merges all the sorted arrays into the file, split between up to
+// merge_threads_count threads if there are enough elements
+static void merge_arrays_to_file(const array_struct *arrays, int arrays_count,
+                                 const char *filename, merge_stats *stats)
+{
+    size_t total_size = 0;
+    for (int i = 0; i < arrays_count; ++i)
+        total_size += arrays[i].size;
+    stats->elements = total_size;
+
+    stats->ranges = merge_threads_count;
+    if ((size_t)stats->ranges > total_size / PARALLEL_MERGE_MIN_SIZE)
+        stats->ranges = total_size / PARALLEL_MERGE_MIN_SIZE;
+    if (stats->ranges > 1) {
+        int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror(filename);
+            exit(1);
+        }
+        stats->passes = 1;
+        merge_arrays_parallel(arrays, arrays_count, total_size, fd, stats);
+        close(fd);
         return;
+    }
+
+    stats->ranges = 1;
+    stats->passes = 1;
+    merge_source *sources = malloc(arrays_count * sizeof(merge_source));
+    for (int i = 0; i < arrays_count; ++i)
+        merge_source_init_array(&sources[i], &arrays[i], 0, arrays[i].size);
 
-    merge_arrays_list(arrays, arrays_count  / 2);
-    merge_arrays_list(arrays + arrays_count / 2, arrays_count - arrays_count / 2);
-    merge_arrays(&arrays[0], &arrays[arrays_count / 2]);
+    output_writer writer;
+    output_writer_open(&writer, filename);
+    put_output_header(&writer, total_size);
+    merge_sources_to_file(sources, arrays_count, total_size, &writer);
+    output_writer_close(&writer);
+    free(sources);
+    stats->bytes_written = writer.bytes_written;
+    stats->write_time = writer.write_time;
 }
 
-#define stack_size 32 * 1024
+// the smallest read buffer of a run in the external merge,
+// it limits how many runs are merged at once
+#define MERGE_MIN_BUFFER_SIZE (64 << 10)
 
-static void* allocate_stack()
+// sets the sources up to stream the runs through buffers of buffer_size
+// elements taken from memory, returns the total size of the runs
+static size_t open_run_sources(merge_source *sources, const spilled_run *runs, int count,
+                               char *memory, size_t buffer_size)
 {
-    void *stack = malloc(stack_size);
-    stack_t ss;
-    ss.ss_sp = stack;
-    ss.ss_size = stack_size;
-    ss.ss_flags = 0;
-    sigaltstack(&ss, NULL);
-    return stack;
+    size_t total_size = 0;
+    for (int i = 0; i < count; ++i) {
+        sources[i].buf = memory + i * buffer_size * elem_size;
+        sources[i].buf_size = buffer_size;
+        sources[i].fd = runs[i].fd;
+        sources[i].offset = runs[i].offset;
+        sources[i].left = runs[i].size;
+        merge_source_refill(&sources[i]);
+        total_size += runs[i].size;
+    }
+    return total_size;
 }
 
-static void print_coro_durations()
+// merges the runs into one run appended to the spill file at *file_size
+static spilled_run merge_runs_to_spill(const spilled_run *runs, int count, char *memory,
+                                       size_t memory_size, int fd, off_t *file_size)
 {
-    for (int i = 0; i < files_count; ++i)
-        printf("Coroutine %d ran for %ld us\n", i, coros[i].total_time * 1000000 / CLOCKS_PER_SEC);
+    // one more buffer collects the output
+    size_t buffer_size = memory_size / (count + 1);
+    merge_source *sources = malloc(count * sizeof(merge_source));
+    size_t total_size = open_run_sources(sources, runs, count, memory, buffer_size);
+    char *out = memory + count * buffer_size * elem_size;
+    spilled_run merged = {fd, *file_size, total_size};
+
+    loser_tree tree;
+    loser_tree_init(&tree, sources, count);
+
+    size_t buffered = 0;
+    for (size_t i = 0; i < total_size; ++i) {
+        merge_source *winner = &sources[tree.nodes[0]];
+        memcpy(out + buffered++ * elem_size, winner->cur, elem_size);
+        merge_source_next(winner);
+        loser_tree_replay(&tree);
+
+        if (buffered == buffer_size || i + 1 == total_size) {
+            pwrite_all(fd, out, buffered * elem_size, *file_size);
+            *file_size += buffered * elem_size;
+            buffered = 0;
+        }
+    }
+
+    loser_tree_free(&tree);
+    free(sources);
+    return merged;
 }
 
-static void init_coros(char *filenames[], array_struct *sorted_arrays, ucontext_t *main_context)
+// the external-memory mode: merges the spilled runs of all the files and
+// streams the result into writer, takes the ownership of the runs,
+// the number of elements and merge passes go to stats
+static void merge_spilled_to_file(run_list *lists, int lists_count, output_writer *writer,
+                                  merge_stats *stats)
 {
-    coros = malloc(files_count * sizeof(coro_struct));
+    stats->elements = 0;
+    stats->passes = 0;
+    int count = 0;
+    for (int i = 0; i < lists_count; ++i)
+        count += lists[i].count;
+    spilled_run *runs = malloc((count ? count : 1) * sizeof(spilled_run));
+    count = 0;
+    for (int i = 0; i < lists_count; ++i) {
+        memcpy(runs + count, lists[i].runs, lists[i].count * sizeof(spilled_run));
+        count += lists[i].count;
+    }
+    if (!count) {
+        put_output_header(writer, 0);
+        free(runs);
+        return;
+    }
+
+    // the output writer has two buffers of its own
+    size_t memory_size = (memory_budget - 2 * OUTPUT_BUFFER_SIZE) / elem_size;
+    int fan_in = memory_size * elem_size / MERGE_MIN_BUFFER_SIZE - 1;
+    if (fan_in < 2)
+        fan_in = 2;
+    char *memory = malloc(memory_size * elem_size);
+    stats->passes = 1;
+
+    // too many runs to read them all at once are merged into longer runs first
+    while (count > fan_in) {
+        int merged_count = (count + fan_in - 1) / fan_in;
+        spilled_run *merged = malloc(merged_count * sizeof(spilled_run));
+        int fd = create_spill_file();
+        off_t file_size = 0;
+        for (int i = 0; i < merged_count; ++i) {
+            int group = count - i * fan_in < fan_in ? count - i * fan_in : fan_in;
+            merged[i] = merge_runs_to_spill(runs + i * fan_in, group, memory, memory_size,
+                                            fd, &file_size);
+        }
+
+        close_run_files(runs, count);
+        free(runs);
+        runs = merged;
+        count = merged_count;
+        stats->passes++;
+    }
+
+    merge_source *sources = malloc(count * sizeof(merge_source));
+    size_t total_size = open_run_sources(sources, runs, count, memory, memory_size / count);
+    put_output_header(writer, total_size);
+    merge_sources_to_file(sources, count, total_size, writer);
+    stats->elements = total_size;
+
+    free(sources);
+    free(memory);
+    close_run_files(runs, count);
+    free(runs);
+}
+
+// totals of the coroutines, kept for --stats after they are freed
+typedef struct sort_stats
+{
+    const char *input;                 // how the files were read
+    long long sort_time;               // us from starting the workers until all finished
+    long long phase_time[PHASE_COUNT]; // us, summed over the coroutines
+    long long io_wait_time;            // us, summed over the coroutines
+    long long switches, io_switches;
+#ifdef SORT_INSTRUMENT
+    long long bytes_read, bytes_written;
+    long long allocations, allocated_bytes;
+#endif
+} sort_stats;
+
+// prints what the coroutines and the workers did and sums it up in stats
+static void print_coro_durations(long long sort_time, sort_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->input = use_mmap ? "mmap" : scheduler.workers[0].has_ring ? "io_uring" : "POSIX AIO";
+    stats->sort_time = sort_time;
+    printf("Input is read with %s\n", stats->input);
+    printf("Quantum is %lld us\n", quantum);
+    for (int i = 0; i < files_count; ++i) {
+        const coro_struct *coro = tasks[i].coro;
+        printf("Coroutine %d ran for %lld us on worker %d, %lld context switches (%lld on I/O)\n",
+               i, coro->total_time, coro->worker->id, coro->switch_count, coro->io_switch_count);
+        stats->switches += coro->switch_count;
+        stats->io_switches += coro->io_switch_count;
+        stats->io_wait_time += coro->io_wait_time;
+        for (int phase = 0; phase < PHASE_COUNT; ++phase)
+            stats->phase_time[phase] += tasks[i].phase_time[phase];
+#ifdef SORT_INSTRUMENT
+        stats->bytes_read += tasks[i].bytes_read;
+        stats->bytes_written += tasks[i].bytes_written;
+        stats->allocations += tasks[i].allocations;
+        stats->allocated_bytes += tasks[i].allocated_bytes;
+#endif
+    }
+    printf("%lld context switches in total, %lld on the quantum, %lld waiting for I/O\n",
+           stats->switches, stats->switches - stats->io_switches, stats->io_switches);
+    printf("Coroutines spent %lld us reading, %lld us parsing, %lld us partitioning, "
+           "%lld us sorting, %lld us spilling, %lld us waited for I/O\n",
+           stats->phase_time[PHASE_READ], stats->phase_time[PHASE_PARSE],
+           stats->phase_time[PHASE_PARTITION], stats->phase_time[PHASE_SORT],
+           stats->phase_time[PHASE_SPILL], stats->io_wait_time);
+    INSTRUMENT(
+        printf("Coroutines read %lld bytes, spilled %lld bytes, "
+               "made %lld allocations of %lld bytes\n", stats->bytes_read, stats->bytes_written,
+               stats->allocations, stats->allocated_bytes);
+    )
+    for (int i = 0; i < workers_count; ++i) {
+        const coro_worker *w = &scheduler.workers[i];
+        printf("Worker %d ran %d coroutines (%d stolen) on %d stacks, busy for %lld of %lld us (%.1f%%)\n",
+               i, w->started_count, w->stolen_count, w->stacks.mapped_count, w->busy_time, sort_time,
+               sort_time ? 100.0 * w->busy_time / sort_time : 0.0);
+    }
+}
+
+// body of every coroutine
+static void* sort_task_run(void *arg)
+{
+    sort_task *task = arg;
+    INSTRUMENT(task->phase_start = get_time_us();)
+    if (memory_limit)
+        sort_file_external(task->filename, task->runs);
+    else if (use_sample_sort)
+        sample_sort_file(task);
+    else
+        sort_file(task->filename, task->res_arr);
+    printf("Coro %d finished sorting\n", task->id);
+    return NULL;
+}
+
+// the external-memory mode: the least memory of a coroutine,
+// fewer coroutines are interleaved rather than sort shorter runs
+#define EXTERNAL_MIN_CORO_MEMORY (4 << 20)
+
+static void init_coros(char *filenames[], array_struct *sorted_arrays, run_list *spilled)
+{
+    // a single thread interleaves all the coroutines, several threads keep
+    // only a couple in flight each, so that the others can be stolen,
+    // the coroutines of --sample-sort wait for each other, so all of them run
+    worker_active_limit = workers_count == 1 ? files_count : 2;
+    if (use_sample_sort) {
+        worker_active_limit = 0;
+        sample_sort_init(files_count);
+    }
+
+    // every coroutine running at once gets an equal share of the memory
+    if (memory_limit) {
+        size_t least = EXTERNAL_MIN_CORO_MEMORY + stack_size;
+        if (memory_budget / (workers_count * worker_active_limit) < least) {
+            worker_active_limit = memory_budget / least / workers_count;
+            if (worker_active_limit < 1)
+                worker_active_limit = 1;
+        }
+        // the stack is committed lazily, but it may be used up to the end
+        coro_memory = memory_budget / (workers_count * worker_active_limit) - stack_size;
+    }
+
+    coro_config config;
+    config.workers = workers_count;
+    config.active_limit = worker_active_limit;
+    config.stack_size = stack_size;
+    config.quantum = quantum;
+    // nothing is read with --mmap, so no ring is needed either
+    config.use_aio = use_aio || use_mmap;
+#ifdef SORT_INSTRUMENT
+    traces = malloc((workers_count + 1) * sizeof(trace_buffer));
+    for (int i = 0; i <= workers_count; ++i)
+        trace_buffer_init(&traces[i]);
+    config.on_slice = trace_path ? trace_slice : NULL;
+    config.hook_arg = traces;
+#endif
+    coro_sched_init(&scheduler, &config);
+
+    tasks = malloc(files_count * sizeof(sort_task));
     for (int i = 0; i < files_count; ++i) {
-        ucontext_t *cur_context = &coros[i].context;
-        getcontext(cur_context);
-        cur_context->uc_stack.ss_sp = allocate_stack();
-        cur_context->uc_stack.ss_size = stack_size;
-        cur_context->uc_link = main_context;
-        makecontext(cur_context, sort_file, 2, filenames[i], &sorted_arrays[i]);
+        tasks[i].filename = filenames[i];
+        tasks[i].res_arr = &sorted_arrays[i];
+        tasks[i].runs = &spilled[i];
+        tasks[i].id = i;
+        memset(tasks[i].phase_time, 0, sizeof(tasks[i].phase_time));
+        tasks[i].phase_mark = 0;
+#ifdef SORT_INSTRUMENT
+        tasks[i].bytes_read = tasks[i].bytes_written = 0;
+        tasks[i].allocations = tasks[i].allocated_bytes = 0;
+#endif
+        // spawned in order, so the ids of the coroutines are the ones of the files
+        tasks[i].coro = coro_spawn(&scheduler, sort_task_run, &tasks[i]);
+    }
+}
+
+static void free_coros()
+{
+    coro_sched_destroy(&scheduler);
+    free(tasks);
+}
+
+// returns the value of a "field: value kB" line of /proc/self/status in bytes,
+// 0 if there is no such line
+static size_t proc_status_bytes(const char *field)
+{
+    FILE *status = fopen("/proc/self/status", "r");
+    if (!status)
+        return 0;
 
-        coros[i].last_timestamp = clock();
-        coros[i].total_time = 0;
-        coros[i].is_finished = 0;
+    char line[256];
+    size_t kib = 0, field_len = strlen(field);
+    while (fgets(line, sizeof(line), status)) {
+        if (!strncmp(line, field, field_len) && line[field_len] == ':') {
+            kib = strtoull(line + field_len + 1, NULL, 10);
+            break;
+        }
     }
+    fclose(status);
+    return kib * 1024;
+}
+
+// the high-water mark of the resident set of the process, in bytes
+static size_t peak_rss()
+{
+    size_t peak = proc_status_bytes("VmHWM");
+    if (!peak) {
+        // ru_maxrss may also count the image replaced by exec()
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        peak = usage.ru_maxrss * 1024;
+    }
+    return peak;
+}
+
+// --stats: writes the timings and counters of the run as a JSON object,
+// the phases of the coroutines are summed over them, merge is the time of
+// the output stage and write the part of it the writer threads spent writing
+static void write_stats(const char *path, const sort_stats *sorted, const merge_stats *merged,
+                        long long output_time, long long total_time)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"files\": %d,\n", files_count);
+    fprintf(file, "  \"type\": \"%s\",\n", elem_type_names[element_type]);
+    fprintf(file, "  \"elements\": %zu,\n", merged->elements);
+    fprintf(file, "  \"threads\": %d,\n", merge_threads_count);
+    fprintf(file, "  \"input\": \"%s\",\n", sorted->input);
+    fprintf(file, "  \"memory_limit\": %zu,\n", memory_limit);
+    fprintf(file, "  \"phase_us\": {");
+    for (int phase = 0; phase < PHASE_COUNT; ++phase)
+        fprintf(file, "\"%s\": %lld, ", coro_phase_names[phase], sorted->phase_time[phase]);
+    fprintf(file, "\"merge\": %lld, \"write\": %lld},\n", output_time, merged->write_time);
+    fprintf(file, "  \"io_wait_us\": %lld,\n", sorted->io_wait_time);
+    fprintf(file, "  \"sort_us\": %lld,\n", sorted->sort_time);
+    fprintf(file, "  \"total_us\": %lld,\n", total_time);
+    fprintf(file, "  \"context_switches\": %lld,\n", sorted->switches);
+    fprintf(file, "  \"io_context_switches\": %lld,\n", sorted->io_switches);
+    fprintf(file, "  \"merge_threads\": %d,\n", merged->ranges);
+    fprintf(file, "  \"merge_passes\": %d,\n", merged->passes);
+    fprintf(file, "  \"bytes_written\": %lld,\n", merged->bytes_written);
+    fprintf(file, "  \"peak_rss_kib\": %zu,\n", peak_rss() / 1024);
+#ifdef SORT_INSTRUMENT
+    fprintf(file, "  \"bytes_read\": %lld,\n", sorted->bytes_read);
+    fprintf(file, "  \"bytes_spilled\": %lld,\n", sorted->bytes_written);
+    fprintf(file, "  \"allocations\": %lld,\n", sorted->allocations);
+    fprintf(file, "  \"allocated_bytes\": %lld,\n", sorted->allocated_bytes);
+#endif
+    fprintf(file, "  \"elements_per_s\": %.0f,\n",
+            total_time ? merged->elements * 1e6 / total_time : 0.0);
+    fprintf(file, "  \"output_mb_s\": %.1f\n",
+            total_time ? (double)merged->bytes_written / total_time : 0.0);
+    fprintf(file, "}\n");
+    fclose(file);
+}
+
+#ifdef SORT_INSTRUMENT
+// --trace: adds the output stage and the names of the threads to the
+// recorded slices and writes them all out, the trace starts with the sort
+static void write_trace(long long sort_start, long long output_start, long long output_time)
+{
+    trace_buffer *output_trace = &traces[workers_count];
+    if (trace_path) {
+        trace_add_event(output_trace, "merge and write", -1, "output", 0, workers_count,
+                        output_start, output_time);
+        trace_add_name(output_trace, 0, -1, "workers", -1);
+        for (int i = 0; i < workers_count; ++i)
+            trace_add_name(output_trace, 0, i, "worker", i);
+        trace_add_name(output_trace, 0, workers_count, "output", -1);
+        trace_add_name(output_trace, 1, -1, "coroutine phases", -1);
+        for (int i = 0; i < files_count; ++i)
+            trace_add_name(output_trace, 1, i, "coroutine", i);
+
+        if (trace_write(trace_path, traces, workers_count + 1, sort_start) < 0) {
+            perror(trace_path);
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i <= workers_count; ++i)
+        trace_buffer_free(&traces[i]);
+    free(traces);
 }
+#endif
 
 // merges all the files into result.txt
 static void sort_and_merge_files(char *filenames[])
 {
     array_struct *sorted_arrays = malloc(files_count * sizeof(array_struct));
+    run_list *spilled = calloc(files_count, sizeof(run_list));
 
-    ucontext_t main_context;
-    init_coros(filenames, sorted_arrays, &main_context);
-    swapcontext(&main_context, &coros[0].context);
+    init_coros(filenames, sorted_arrays, spilled);
 
-    // by this line all coros finished their work
-    print_coro_durations();
+    // the main thread is worker 0
+    long long sort_start = get_time_us();
+    coro_sched_run(&scheduler);
 
-    // free coros
-    for (int i = 0; i < files_count; ++i)
-        free(coros[i].context.uc_stack.ss_sp);
-    free(coros);
+    // by this line all coros finished their work
+    sort_stats sorted;
+    print_coro_durations(get_time_us() - sort_start, &sorted);
+    free_coros();
 
-    //merge arrays into sorted_arrays[0]
-    merge_arrays_list(sorted_arrays, files_count);
-    array_struct res_arr = sorted_arrays[0];
+    long long output_start = get_time_us();
+    merge_stats merged;
+    memset(&merged, 0, sizeof(merged));
+    if (memory_limit) {
+        output_writer writer;
+        output_writer_open(&writer, "result.txt");
+        merge_spilled_to_file(spilled, files_count, &writer, &merged);
+        output_writer_close(&writer);
+        merged.ranges = 1;
+        merged.bytes_written = writer.bytes_written;
+        merged.write_time = writer.write_time;
+    } else if (use_sample_sort) {
+        // the buckets are in order already, the result is only written
+        array_struct result;
+        result.data = sampler.result;
+        result.size = sampler.total;
+        merge_arrays_to_file(&result, 1, "result.txt", &merged);
+        arena_free(&sampler.arena);
+        sample_sort_free();
+    } else {
+        merge_arrays_to_file(sorted_arrays, files_count, "result.txt", &merged);
+    }
 
-    FILE *res_file = fopen("result.txt", "w");
-    for (int i = 0; i < res_arr.size; ++i)
-        fprintf(res_file, "%d ", res_arr.p_arr[i]);
+    long long output_time = get_time_us() - output_start;
+    printf("Merged and wrote %lld bytes in %lld us (%.1f MB/s)\n", merged.bytes_written,
+           output_time, output_time ? (double)merged.bytes_written / output_time : 0.0);
+    if (merged.ranges > 1)
+        printf("The merge was split into %d ranges, a thread each\n", merged.ranges);
 
-    fclose(res_file);
-    free(res_arr.p_arr);
+    if (memory_limit) {
+        int runs_count = 0;
+        for (int i = 0; i < files_count; ++i) {
+            runs_count += spilled[i].count;
+            free(spilled[i].runs);
+        }
+        printf("Spilled %d runs of up to %zu elements, %d merge passes\n", runs_count,
+               external_run_capacity(), merged.passes);
+        printf("Peak RSS is %zu KiB, memory limit is %zu KiB\n", peak_rss() / 1024,
+               memory_limit / 1024);
+    } else {
+        for (int i = 0; i < files_count; ++i)
+            arena_free(&sorted_arrays[i].arena);
+    }
+    free(spilled);
     free(sorted_arrays);
+
+    if (stats_path)
+        write_stats(stats_path, &sorted, &merged, output_time, get_time_us() - sort_start);
+    INSTRUMENT(write_trace(sort_start, output_start, output_time);)
+}
+
+static void usage(char *prog_name)
+{
+    fprintf(stderr, "Usage: %s [-j threads] [-m memory limit[K|M|G]] [-T temp dir] "
+                    "[--stack-size size[K|M]] [--mmap | --aio] [--pipeline | --sample-sort] "
+                    "[--radix | --natural] [--binary] [--type int32|int64|record] "
+                    "[--stats file.json] [--trace file.json] <target latency, us> <file>...\n", prog_name);
+    exit(1);
+}
+
+// stdio and the error paths need about this much
+#define MIN_STACK_SIZE (16 * 1024)
+
+// the least memory the buffers of the external-memory mode need: the
+// output buffers and the merge buffers of a few dozen runs
+#define MIN_MEMORY_BUDGET (4 << 20)
+// the external-memory mode: what the queues and stdio use besides the buffers
+#define EXTERNAL_RUNTIME_MEMORY (256 << 10)
+// the external-memory mode: what a worker adds, its thread and signal stacks,
+// io_uring ring and malloc arena, the arena keeps some of it through the
+// final merge
+#define WORKER_RUNTIME_MEMORY (256 << 10)
+
+// parses a byte count with an optional K, M or G suffix, returns 0 on error
+static size_t parse_size(const char *str)
+{
+    char *end;
+    unsigned long long size = strtoull(str, &end, 10);
+    switch (toupper((unsigned char)*end)) {
+        case 'G':
+            size <<= 10;
+            // fall through
+        case 'M':
+            size <<= 10;
+            // fall through
+        case 'K':
+            size <<= 10;
+            end++;
+    }
+    return *end || end == str ? 0 : size;
 }
 
 int main(int argc, char** argv)
 {
-    assert(argc > 1);
+    static struct option long_options[] = {
+        {"mmap", no_argument, &use_mmap, 1},
+        {"aio", no_argument, &use_aio, 1},
+        {"radix", no_argument, &use_radix, 1},
+        {"natural", no_argument, &use_natural, 1},
+        {"pipeline", no_argument, &use_pipeline, 1},
+        {"sample-sort", no_argument, &use_sample_sort, 1},
+        {"binary", no_argument, &binary_output, 1},
+        {"memory-limit", required_argument, NULL, 'm'},
+        {"temp-dir", required_argument, NULL, 'T'},
+        {"stack-size", required_argument, NULL, 'S'},
+        {"type", required_argument, NULL, 't'},
+        {"stats", required_argument, NULL, 's'},
+        {"trace", required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0}
+    };
 
-    files_count = argc - 1;
+    char *end;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:m:T:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 0: // a flag is set by getopt_long()
+                break;
+            case 'j':
+                workers_count = strtol(optarg, &end, 10);
+                if (*end || workers_count <= 0)
+                    usage(argv[0]);
+                break;
+            case 'm':
+                memory_limit = parse_size(optarg);
+                if (!memory_limit)
+                    usage(argv[0]);
+                break;
+            case 'T':
+                temp_dir = optarg;
+                break;
+            case 'S':
+                stack_size = parse_size(optarg);
+                if (stack_size < MIN_STACK_SIZE)
+                    usage(argv[0]);
+                break;
+            case 's':
+                stats_path = optarg;
+                break;
+            case 'r':
+#ifndef SORT_INSTRUMENT
+                fprintf(stderr, "--trace needs a build with INSTRUMENT=1\n");
+                exit(1);
+#endif
+                trace_path = optarg;
+                break;
+            case 't': {
+                int type = 0;
+                while (type <= ELEM_RECORD && strcmp(optarg, elem_type_names[type]))
+                    ++type;
+                if (type > ELEM_RECORD)
+                    usage(argv[0]);
+                element_type = type;
+                elem_size = type == ELEM_INT32 ? sizeof(int) :
+                            type == ELEM_INT64 ? sizeof(int64_t) : sizeof(sort_record);
+                elem_numbers = type == ELEM_RECORD ? 2 : 1;
+                break;
+            }
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (argc - optind < 2)
+        usage(argv[0]);
+    // resident pages of a mapping are up to the kernel, they can't be bounded
+    if (memory_limit && use_mmap) {
+        fprintf(stderr, "--mmap can't be used with a memory limit\n");
+        exit(1);
+    }
+    if (use_pipeline && (use_mmap || memory_limit)) {
+        fprintf(stderr, "--pipeline can't be used with --mmap or a memory limit\n");
+        exit(1);
+    }
+    if (use_sample_sort && (use_pipeline || memory_limit)) {
+        fprintf(stderr, "--sample-sort can't be used with --pipeline or a memory limit\n");
+        exit(1);
+    }
+    if (!temp_dir)
+        temp_dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+
+    long long target_latency = strtoll(argv[optind], &end, 10);
+    if (*end || target_latency <= 0)
+        usage(argv[0]);
+
+    files_count = argc - optind - 1;
+    merge_threads_count = workers_count;
+    if (workers_count > files_count)
+        workers_count = files_count;
+    quantum = target_latency / files_count;
+    if (quantum < 1)
+        quantum = 1;
+
+    if (memory_limit) {
+        // the program itself and the worker threads with their rings take
+        // their part first, the coroutine stacks are a part of coro_memory
+        size_t overhead = proc_status_bytes("VmRSS") + EXTERNAL_RUNTIME_MEMORY +
+                          workers_count * WORKER_RUNTIME_MEMORY;
+        size_t least = overhead + MIN_MEMORY_BUDGET + workers_count * stack_size;
+        if (memory_limit < least) {
+            fprintf(stderr, "The memory limit is too small, %zu KiB at least are needed\n",
+                    least / 1024);
+            exit(1);
+        }
+        memory_budget = memory_limit - overhead;
+        // freed buffers go straight back to the system instead of staying
+        // in the heap, otherwise a freed run buffer of one thread can't be
+        // reused by another and still counts
+        mallopt(M_MMAP_THRESHOLD, 128 << 10);
+    }
 
-    clock_t start_timestamp = clock();
+    long long start_timestamp = get_time_us();
 
-    sort_and_merge_files(&argv[1]);
+    sort_and_merge_files(&argv[optind + 1]);
 
-    printf("Program ran for %ld us\n", (clock() - start_timestamp) * 1000000 / CLOCKS_PER_SEC);
+    printf("Program ran for %lld us\n", get_time_us() - start_timestamp);
 
     return 0;
 }
@@ -0,0 +1,413 @@
+#ifndef SORT_KERNELS_H
+#define SORT_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Allocation-free sort kernels. Both take a caller-owned scratch buffer of
+// the same size as the array and ping-pong between them.
+//
+// SORT_KERNEL_CHECKPOINT(n) is invoked after every n elements of work, a
+// caller running the kernels inside a coroutine defines it before including
+// this header to keep its time quantum.
+#ifndef SORT_KERNEL_CHECKPOINT
+#define SORT_KERNEL_CHECKPOINT(n) ((void)0)
+#endif
+
+// base case of the merge sort: about a cache line of elements
+#define SORT_RUN_BYTES 64
+// the longest stretch of merging done between two checkpoints
+#define SORT_MERGE_STEP 4096
+// natural merge sort: runs shorter than this (or than the array, if it is
+// shorter) are extended with insertion sort
+#define SORT_MIN_RUN 32
+// a side winning this many times in a row switches the merge to galloping
+#define SORT_MIN_GALLOP 7
+// the run lengths on the stack grow at least like Fibonacci numbers, so
+// this is enough for any size_t size
+#define SORT_MAX_RUNS 96
+
+// key + payload record, ordered by the key only
+typedef struct sort_record
+{
+    int64_t key;
+    int64_t payload;
+} sort_record;
+
+#define SORT_KEY_SELF(x) (x)
+#define SORT_KEY_FIELD(x) ((x).key)
+
+// SORT_KERNELS_DEFINE(name, type, key_type, ukey_type, KEY) defines for
+// arrays of type ordered by the signed integer key_type KEY(element),
+// ukey_type is its unsigned counterpart:
+//   sort_run_<name>(src, dst, size): insertion sort of a short run from src
+//       into dst (may be the same)
+//   merge_runs_<name>(a, a_end, b, b_end, out): branchless merge
+//   merge_passes_<name>(src, dst, size, width): bottom-up merge of the
+//       sorted runs of width elements, returns src or dst, whichever holds
+//       the result
+//   merge_sort_<name>(array, tmp, size): bottom-up merge sort
+//   radix_sort_<name>(array, tmp, size): LSD radix sort by 8-bit digits
+//   natural_sort_<name>(array, tmp, size): TimSort-style merge of the
+//       ascending and descending runs already in the array, with galloping
+//   presorted_<name>(array, size, min_run): whether the runs natural_sort
+//       would find are min_run elements long on average
+// Every function is compiled for its type, keys are compared inline. All
+// the sorts are stable, equal keys keep the order of the input.
+#define SORT_KERNELS_DEFINE(name, type, key_type, ukey_type, KEY) \
+\
+/* insertion sort of array whose first sorted elements are in order */ \
+static inline void insertion_sort_##name(type *array, size_t sorted, size_t size) \
+{ \
+    for (size_t i = sorted ? sorted : 1; i < size; ++i) { \
+        type value = array[i]; \
+        size_t j = i; \
+        for (; j > 0 && KEY(array[j - 1]) > KEY(value); --j) \
+            array[j] = array[j - 1]; \
+        array[j] = value; \
+    } \
+} \
+\
+static inline void sort_run_##name(const type *src, type *dst, size_t size) \
+{ \
+    if (src != dst) \
+        memcpy(dst, src, size * sizeof(type)); \
+    insertion_sort_##name(dst, 1, size); \
+} \
+\
+static inline void merge_runs_##name(const type *a, const type *a_end, \
+                                     const type *b, const type *b_end, type *out) \
+{ \
+    while (a < a_end && b < b_end) { \
+        /* within a step neither side can run out, so the loop only counts, */ \
+        /* and the selection compiles to conditional moves instead of branches */ \
+        size_t step = a_end - a < b_end - b ? a_end - a : b_end - b; \
+        if (step > SORT_MERGE_STEP) \
+            step = SORT_MERGE_STEP; \
+        for (size_t i = 0; i < step; ++i) { \
+            int take_b = KEY(*b) < KEY(*a); \
+            *out++ = take_b ? *b : *a; \
+            a += !take_b; \
+            b += take_b; \
+        } \
+        SORT_KERNEL_CHECKPOINT(step); \
+    } \
+    memcpy(out, a, (a_end - a) * sizeof(type)); \
+    out += a_end - a; \
+    memcpy(out, b, (b_end - b) * sizeof(type)); \
+} \
+\
+/* merges the sorted runs of width elements of src pass by pass, moving */ \
+/* them between src and dst, returns the one the result ends up in */ \
+static type* merge_passes_##name(type *src, type *dst, size_t size, size_t width) \
+{ \
+    for (; width < size; width *= 2) { \
+        for (size_t i = 0; i < size; i += 2 * width) { \
+            size_t mid = i + width < size ? i + width : size; \
+            size_t end = i + 2 * width < size ? i + 2 * width : size; \
+            merge_runs_##name(src + i, src + mid, src + mid, src + end, dst + i); \
+        } \
+        type *swap = src; \
+        src = dst; \
+        dst = swap; \
+    } \
+    return src; \
+} \
+\
+/* tmp must have room for size elements */ \
+static void merge_sort_##name(type *array, type *tmp, size_t size) \
+{ \
+    const size_t run_size = SORT_RUN_BYTES / sizeof(type) > 4 ? SORT_RUN_BYTES / sizeof(type) : 4; \
+    /* every pass moves the data to the other buffer, so the runs are built */ \
+    /* in the buffer that makes the last pass end up in array */ \
+    int passes = 0; \
+    for (size_t width = run_size; width < size; width *= 2) \
+        ++passes; \
+    type *src = passes % 2 ? tmp : array; \
+    type *dst = passes % 2 ? array : tmp; \
+\
+    for (size_t i = 0; i < size; i += run_size) { \
+        size_t run = size - i < run_size ? size - i : run_size; \
+        sort_run_##name(array + i, src + i, run); \
+        SORT_KERNEL_CHECKPOINT(run); \
+    } \
+    merge_passes_##name(src, dst, size, run_size); \
+} \
+\
+/* tmp must have room for size elements */ \
+static void radix_sort_##name(type *array, type *tmp, size_t size) \
+{ \
+    enum { digits = sizeof(key_type) }; \
+    const ukey_type sign = (ukey_type)1 << (8 * sizeof(key_type) - 1); \
+    /* 32-bit counters keep the histograms small enough for a coroutine stack */ \
+    if (size > UINT32_MAX) { \
+        merge_sort_##name(array, tmp, size); \
+        return; \
+    } \
+    uint32_t counts[digits][256]; \
+    memset(counts, 0, sizeof(counts)); \
+\
+    /* the sign bit is flipped so that negative keys go first */ \
+    for (size_t i = 0; i < size; ++i) { \
+        ukey_type key = (ukey_type)KEY(array[i]) ^ sign; \
+        for (int digit = 0; digit < digits; ++digit) \
+            counts[digit][(key >> (8 * digit)) & 0xff]++; \
+    } \
+    SORT_KERNEL_CHECKPOINT(size); \
+\
+    type *src = array, *dst = tmp; \
+    for (int digit = 0; digit < digits; ++digit) { \
+        int shift = digit * 8; \
+        /* a digit all the keys share doesn't reorder anything */ \
+        if (size && counts[digit][(((ukey_type)KEY(src[0]) ^ sign) >> shift) & 0xff] == size) \
+            continue; \
+\
+        uint32_t offsets[256], sum = 0; \
+        for (int i = 0; i < 256; ++i) { \
+            offsets[i] = sum; \
+            sum += counts[digit][i]; \
+        } \
+\
+        for (size_t i = 0; i < size; i += SORT_MERGE_STEP) { \
+            size_t end = size - i < SORT_MERGE_STEP ? size : i + SORT_MERGE_STEP; \
+            for (size_t j = i; j < end; ++j) { \
+                ukey_type key = (ukey_type)KEY(src[j]) ^ sign; \
+                dst[offsets[(key >> shift) & 0xff]++] = src[j]; \
+            } \
+            SORT_KERNEL_CHECKPOINT(end - i); \
+        } \
+\
+        type *swap = src; \
+        src = dst; \
+        dst = swap; \
+    } \
+\
+    if (src != array) \
+        memcpy(array, src, size * sizeof(type)); \
+} \
+\
+/* the length of the run at the start of array, *descending is set if it */ \
+/* goes strictly down, equal keys end such a run to keep the sort stable */ \
+static inline size_t run_length_##name(const type *array, size_t size, int *descending) \
+{ \
+    *descending = 0; \
+    if (size < 2) \
+        return size; \
+    size_t n = 2; \
+    if (KEY(array[1]) < KEY(array[0])) { \
+        *descending = 1; \
+        while (n < size && KEY(array[n]) < KEY(array[n - 1])) \
+            ++n; \
+    } else { \
+        while (n < size && KEY(array[n]) >= KEY(array[n - 1])) \
+            ++n; \
+    } \
+    return n; \
+} \
+\
+/* the number of leading elements of the sorted array that go before key: */ \
+/* those with smaller keys, or with keys not greater if after_equal; found */ \
+/* by galloping from the front or from the back, then by binary search */ \
+static inline size_t gallop_##name(key_type key, const type *array, size_t size, \
+                                   int after_equal, int from_back) \
+{ \
+    size_t lo, hi, last = 0, step = 1; \
+    if (!size) \
+        return 0; \
+    if (!from_back) { \
+        if (!(after_equal ? KEY(array[0]) <= key : KEY(array[0]) < key)) \
+            return 0; \
+        while (step < size && (after_equal ? KEY(array[step]) <= key : KEY(array[step]) < key)) { \
+            last = step; \
+            step = 2 * step + 1; \
+        } \
+        lo = last + 1; \
+        hi = step < size ? step : size; \
+    } else { \
+        if (after_equal ? KEY(array[size - 1]) <= key : KEY(array[size - 1]) < key) \
+            return size; \
+        while (step < size && \
+               !(after_equal ? KEY(array[size - 1 - step]) <= key : KEY(array[size - 1 - step]) < key)) { \
+            last = step; \
+            step = 2 * step + 1; \
+        } \
+        lo = step < size ? size - step : 0; \
+        hi = size - 1 - last; \
+    } \
+    while (lo < hi) { \
+        size_t mid = lo + (hi - lo) / 2; \
+        if (after_equal ? KEY(array[mid]) <= key : KEY(array[mid]) < key) \
+            lo = mid + 1; \
+        else \
+            hi = mid; \
+    } \
+    return lo; \
+} \
+\
+/* merges a with b right after it, copying a, the shorter one, to tmp */ \
+static void merge_low_##name(type *a, size_t a_size, size_t b_size, type *tmp) \
+{ \
+    memcpy(tmp, a, a_size * sizeof(type)); \
+    type *l = tmp, *l_end = tmp + a_size, *r = a + a_size, *r_end = r + b_size, *out = a; \
+    while (l < l_end && r < r_end) { \
+        type *start = out; \
+        size_t l_wins = 0, r_wins = 0; \
+        /* branchless like merge_runs_<name>(), the wins are counted in a row */ \
+        while (l < l_end && r < r_end && l_wins < SORT_MIN_GALLOP && r_wins < SORT_MIN_GALLOP && \
+               out - start < SORT_MERGE_STEP) { \
+            int take_r = KEY(*r) < KEY(*l); \
+            *out++ = take_r ? *r : *l; \
+            r += take_r; \
+            l += !take_r; \
+            r_wins = take_r ? r_wins + 1 : 0; \
+            l_wins = take_r ? 0 : l_wins + 1; \
+        } \
+        /* one side keeps winning, so whole stretches of it are copied */ \
+        while (l < l_end && r < r_end && (l_wins >= SORT_MIN_GALLOP || r_wins >= SORT_MIN_GALLOP)) { \
+            l_wins = gallop_##name(KEY(*r), l, l_end - l, 1, 0); \
+            memcpy(out, l, l_wins * sizeof(type)); \
+            out += l_wins; \
+            l += l_wins; \
+            if (l == l_end) \
+                break; \
+            r_wins = gallop_##name(KEY(*l), r, r_end - r, 0, 0); \
+            memmove(out, r, r_wins * sizeof(type)); \
+            out += r_wins; \
+            r += r_wins; \
+        } \
+        SORT_KERNEL_CHECKPOINT(out - start); \
+    } \
+    /* what is left of b is already in place */ \
+    memcpy(out, l, (l_end - l) * sizeof(type)); \
+} \
+\
+/* merges a with b right after it from the back, copying b to tmp */ \
+static void merge_high_##name(type *a, size_t a_size, size_t b_size, type *tmp) \
+{ \
+    type *b = a + a_size; \
+    memcpy(tmp, b, b_size * sizeof(type)); \
+    type *l = b, *r = tmp + b_size, *out = b + b_size; \
+    while (l > a && r > tmp) { \
+        type *start = out; \
+        size_t l_wins = 0, r_wins = 0; \
+        while (l > a && r > tmp && l_wins < SORT_MIN_GALLOP && r_wins < SORT_MIN_GALLOP && \
+               start - out < SORT_MERGE_STEP) { \
+            int take_l = KEY(r[-1]) < KEY(l[-1]); \
+            *--out = take_l ? l[-1] : r[-1]; \
+            l -= take_l; \
+            r -= !take_l; \
+            l_wins = take_l ? l_wins + 1 : 0; \
+            r_wins = take_l ? 0 : r_wins + 1; \
+        } \
+        while (l > a && r > tmp && (l_wins >= SORT_MIN_GALLOP || r_wins >= SORT_MIN_GALLOP)) { \
+            l_wins = (l - a) - gallop_##name(KEY(r[-1]), a, l - a, 1, 1); \
+            out -= l_wins; \
+            l -= l_wins; \
+            memmove(out, l, l_wins * sizeof(type)); \
+            if (l == a) \
+                break; \
+            r_wins = (r - tmp) - gallop_##name(KEY(l[-1]), tmp, r - tmp, 0, 1); \
+            out -= r_wins; \
+            r -= r_wins; \
+            memcpy(out, r, r_wins * sizeof(type)); \
+        } \
+        SORT_KERNEL_CHECKPOINT(start - out); \
+    } \
+    /* what is left of a is already in place */ \
+    memcpy(a, tmp, (r - tmp) * sizeof(type)); \
+} \
+\
+/* merges the adjacent runs a and b, leaving out their ends already in place */ \
+static void merge_adjacent_##name(type *a, size_t a_size, size_t b_size, type *tmp) \
+{ \
+    size_t skip = gallop_##name(KEY(a[a_size]), a, a_size, 1, 0); \
+    a += skip; \
+    a_size -= skip; \
+    if (!a_size) \
+        return; \
+    b_size = gallop_##name(KEY(a[a_size - 1]), a + a_size, b_size, 0, 1); \
+    if (!b_size) \
+        return; \
+    if (a_size <= b_size) \
+        merge_low_##name(a, a_size, b_size, tmp); \
+    else \
+        merge_high_##name(a, a_size, b_size, tmp); \
+} \
+\
+/* tmp must have room for size / 2 elements */ \
+static void natural_sort_##name(type *array, type *tmp, size_t size) \
+{ \
+    /* the minimal run length makes size / min_run a power of 2 or just below */ \
+    size_t min_run = size, extra = 0; \
+    while (min_run >= 2 * SORT_MIN_RUN) { \
+        extra |= min_run & 1; \
+        min_run >>= 1; \
+    } \
+    min_run += extra; \
+\
+    size_t base[SORT_MAX_RUNS], length[SORT_MAX_RUNS]; \
+    int runs = 0; \
+    for (size_t i = 0; i < size || runs > 1; ) { \
+        if (i < size) { \
+            int descending; \
+            size_t run = run_length_##name(array + i, size - i, &descending); \
+            for (size_t j = 0; descending && j < run / 2; ++j) { \
+                type swap = array[i + j]; \
+                array[i + j] = array[i + run - 1 - j]; \
+                array[i + run - 1 - j] = swap; \
+            } \
+            if (run < min_run) { \
+                size_t end = size - i < min_run ? size - i : min_run; \
+                insertion_sort_##name(array + i, run, end); \
+                run = end; \
+            } \
+            SORT_KERNEL_CHECKPOINT(run); \
+            base[runs] = i; \
+            length[runs++] = run; \
+            i += run; \
+        } \
+\
+        /* the runs are merged while the lengths on the stack don't shrink */ \
+        /* faster than Fibonacci numbers, and all of them at the end */ \
+        while (runs > 1) { \
+            int k = runs - 2; \
+            if (i == size || (k > 0 && length[k - 1] <= length[k] + length[k + 1]) || \
+                (k > 1 && length[k - 2] <= length[k - 1] + length[k])) { \
+                if (k > 0 && length[k - 1] < length[k + 1]) \
+                    --k; \
+            } else if (length[k] > length[k + 1]) { \
+                break; \
+            } \
+            merge_adjacent_##name(array + base[k], length[k], length[k + 1], tmp); \
+            length[k] += length[k + 1]; \
+            if (k + 2 < runs) { \
+                base[k + 1] = base[k + 2]; \
+                length[k + 1] = length[k + 2]; \
+            } \
+            --runs; \
+        } \
+    } \
+} \
+\
+/* counts the runs until there are too many of them, which random input */ \
+/* reaches in about 2.5 / min_run of the array */ \
+static int presorted_##name(const type *array, size_t size, size_t min_run) \
+{ \
+    size_t max_runs = size / min_run, runs = 0; \
+    for (size_t i = 0; i < size; ++runs) { \
+        if (runs > max_runs) \
+            return 0; \
+        int descending; \
+        size_t run = run_length_##name(array + i, size - i, &descending); \
+        SORT_KERNEL_CHECKPOINT(run); \
+        i += run; \
+    } \
+    return 1; \
+}
+
+SORT_KERNELS_DEFINE(i32, int, int, uint32_t, SORT_KEY_SELF)
+SORT_KERNELS_DEFINE(i64, int64_t, int64_t, uint64_t, SORT_KEY_SELF)
+SORT_KERNELS_DEFINE(rec, sort_record, int64_t, uint64_t, SORT_KEY_FIELD)
+
+#endif
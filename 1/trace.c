@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+void trace_buffer_init(trace_buffer *buffer)
+{
+    buffer->events = NULL;
+    buffer->count = buffer->capacity = 0;
+}
+
+void trace_buffer_free(trace_buffer *buffer)
+{
+    free(buffer->events);
+    trace_buffer_init(buffer);
+}
+
+static trace_event* trace_push(trace_buffer *buffer)
+{
+    if (buffer->count == buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 1024;
+        trace_event *events = realloc(buffer->events, capacity * sizeof(trace_event));
+        if (!events) {
+            perror("trace");
+            exit(1);
+        }
+        buffer->events = events;
+        buffer->capacity = capacity;
+    }
+    return &buffer->events[buffer->count++];
+}
+
+void trace_add_event(trace_buffer *buffer, const char *name, int id, const char *category,
+                     int pid, int tid, long long start, long long duration)
+{
+    trace_event *event = trace_push(buffer);
+    event->type = 'X';
+    event->name = name;
+    event->id = id;
+    event->category = category;
+    event->pid = pid;
+    event->tid = tid;
+    event->start = start;
+    event->duration = duration;
+}
+
+void trace_add_name(trace_buffer *buffer, int pid, int tid, const char *name, int id)
+{
+    trace_event *event = trace_push(buffer);
+    event->type = 'M';
+    event->name = name;
+    event->id = id;
+    event->category = NULL;
+    event->pid = pid;
+    event->tid = tid;
+    event->start = event->duration = 0;
+}
+
+// the name with the id appended, names are string literals without quotes
+static void write_name(FILE *file, const trace_event *event)
+{
+    if (event->id >= 0)
+        fprintf(file, "\"%s %d\"", event->name, event->id);
+    else
+        fprintf(file, "\"%s\"", event->name);
+}
+
+int trace_write(const char *path, const trace_buffer *buffers, int count, long long origin)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return -1;
+
+    fprintf(file, "{\"traceEvents\": [\n");
+    const char *separator = "";
+    for (int i = 0; i < count; ++i) {
+        for (size_t j = 0; j < buffers[i].count; ++j) {
+            const trace_event *event = &buffers[i].events[j];
+            fprintf(file, "%s{", separator);
+            separator = ",\n";
+            if (event->type == 'M') {
+                fprintf(file, "\"name\": \"%s\", \"ph\": \"M\", \"pid\": %d, ",
+                        event->tid < 0 ? "process_name" : "thread_name", event->pid);
+                if (event->tid >= 0)
+                    fprintf(file, "\"tid\": %d, ", event->tid);
+                fprintf(file, "\"args\": {\"name\": ");
+                write_name(file, event);
+                fprintf(file, "}}");
+                continue;
+            }
+
+            fprintf(file, "\"name\": ");
+            write_name(file, event);
+            if (event->category)
+                fprintf(file, ", \"cat\": \"%s\"", event->category);
+            fprintf(file, ", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %lld, \"dur\": %lld}",
+                    event->pid, event->tid, event->start - origin, event->duration);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file);
+}
@@ -0,0 +1,38 @@
+#ifndef SORT_TRACE_H
+#define SORT_TRACE_H
+
+#include <stddef.h>
+
+// Recorder of Chrome trace events, the JSON opens in chrome://tracing and
+// in Perfetto. Every thread records into a buffer of its own, so recording
+// takes no locks, the buffers are written out together at the end.
+typedef struct trace_event
+{
+    char type;                // 'X' a complete event, 'M' a name of pid or tid
+    const char *name;         // not copied, the id is appended if not negative
+    const char *category;     // may be NULL
+    int id;
+    int pid, tid;             // tid is -1 for the name of a process
+    long long start, duration; // us
+} trace_event;
+
+typedef struct trace_buffer
+{
+    trace_event *events;
+    size_t count, capacity;
+} trace_buffer;
+
+void trace_buffer_init(trace_buffer *buffer);
+void trace_buffer_free(trace_buffer *buffer);
+
+// an event of duration us which started at start us
+void trace_add_event(trace_buffer *buffer, const char *name, int id, const char *category,
+                     int pid, int tid, long long start, long long duration);
+// names the process pid, or its thread tid, as name and id in the viewer
+void trace_add_name(trace_buffer *buffer, int pid, int tid, const char *name, int id);
+
+// writes the events of all the buffers to path, origin is subtracted from
+// the timestamps, returns -1 and errno on failure
+int trace_write(const char *path, const trace_buffer *buffers, int count, long long origin);
+
+#endif
@@ -0,0 +1,55 @@
+import subprocess
+import argparse
+import shutil
+import time
+
+# Runs a script of echo, printf, test, pwd and true lines through the shell
+# twice: as it is, so that the builtins run, and with every builtin spelled
+# as the path of its binary, so that each of them is started as a process.
+# Both runs must print the same.
+
+parser = argparse.ArgumentParser(description='Benchmark of the shell builtins')
+parser.add_argument('-e', type=str, default='./task_2',
+		    help='executable shell file')
+parser.add_argument('-n', type=int, default=2000,
+		    help='lines of the script')
+args = parser.parse_args()
+
+lines = [
+	'echo line {i} of the script',
+	'printf "%s-%05d\\n" item {i}',
+	'test {i} -gt 1000',
+	'[ -n "{i}" ]',
+	'echo {i} | cat',
+	'true',
+	'pwd',
+]
+
+def script(binaries):
+	def command(line):
+		word = line.split()[0]
+		return binaries[word] + line[len(word):] if binaries else line
+	return ''.join(command(lines[i % len(lines)]).format(i=i) + '\n'
+		       for i in range(args.n))
+
+def run(text):
+	start = time.monotonic()
+	output = subprocess.run([args.e], input=text.encode(),
+				stdout=subprocess.PIPE, check=True).stdout
+	return output, time.monotonic() - start
+
+binaries = {}
+for line in lines:
+	word = line.split()[0]
+	binaries[word] = shutil.which(word) or '/usr/bin/' + word
+
+builtin_output, builtin_time = run(script(None))
+process_output, process_time = run(script(binaries))
+if builtin_output != process_output:
+	print('The outputs of the builtins and of the binaries differ')
+	exit(1)
+
+for name, elapsed in (('builtins', builtin_time), ('processes', process_time)):
+	print('{}: {} lines in {:.3f} s, {:.0f} lines/s'.format(
+		name, args.n, elapsed, args.n / elapsed))
+print('builtins are {:.1f} times faster'.format(process_time / builtin_time))
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parser.h"
+
+// measures how many lines per second parse_input() gets through on a
+// generated script, execute() only counts and drops the parsed commands
+
+void parse_input();
+
+static long long commands_count, args_count;
+
+void execute(struct command_list *cmd_list)
+{
+    for (int i = 0; i < cmd_list->cmd_num; ++i) {
+        args_count += cmd_list->commands[i].argc;
+        commands_count += cmd_list->commands[i].argc > 0;
+    }
+    clear_cmd_list(cmd_list);
+    alloc_new_cmd(cmd_list);
+}
+
+static long long get_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// a mix of plain, quoted and escaped words, pipes, redirects and comments
+static const char *const lines[] = {
+    "echo 'source string' | sed 's/source/destination/g' | sed 's/string/value/g' > result.txt\n",
+    "cat \"my file with whitespaces in name.txt\" | grep -v \"test 'test'' \\\\\" >> out.txt\n",
+    "   ls -la /usr/share/doc/some/long/path/to/a/directory | tail -c 8   # list it\n",
+    "printf '%s %d\\n' argument\\ with\\ spaces 12345 | wc -l\n",
+    "# a comment line that is skipped as a whole by the parser\n",
+    "true\n",
+};
+
+int main(int argc, char *argv[])
+{
+    long long count = argc > 1 ? atoll(argv[1]) : 1000000;
+    if (count <= 0) {
+        fprintf(stderr, "Usage: %s [lines]\n", argv[0]);
+        return 1;
+    }
+
+    char path[] = "/tmp/bench_parser_XXXXXX";
+    int fd = mkstemp(path);
+    handle_error(fd >= 0);
+    unlink(path);
+    FILE *script = fdopen(fd, "w+");
+    handle_error(script);
+    int kinds = sizeof(lines) / sizeof(lines[0]);
+    for (long long i = 0; i < count; ++i)
+        fputs(lines[i % kinds], script);
+    handle_error(fflush(script) == 0);
+    long long size = ftell(script);
+    handle_error(lseek(fd, 0, SEEK_SET) == 0);
+    handle_error(dup2(fd, STDIN_FILENO) != -1);
+
+    long long start = get_time_ns();
+    parse_input();
+    long long elapsed = get_time_ns() - start;
+
+    printf("%lld lines, %.1f MB: %lld commands, %lld words in %lld us\n", count, size / 1e6,
+           commands_count, args_count, elapsed / 1000);
+    printf("%.2f M lines/s, %.1f MB/s\n", count * 1e3 / elapsed, size * 1e3 / elapsed);
+    fclose(script);
+    return 0;
+}
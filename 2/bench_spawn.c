@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parser.h"
+
+// measures the latency of execute() on `/bin/true | /bin/true | /bin/true`
+// pipelines, the path keeps the true builtin from running instead, the
+// shell first touches a buffer of the given size so that it has as big
+// a resident set as a shell with lots of state would
+
+void execute(struct command_list *cmd_list);
+
+#define STAGES 3
+
+static long long get_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void add_word(command_list *cmd_list, const char *word)
+{
+    command *cmd = &cmd_list->commands[cmd_list->cmd_num - 1];
+    scratch_append(&cmd_list->words, word, strlen(word));
+    cmd->argc++;
+    cmd->argv = realloc(cmd->argv, cmd->argc * sizeof(char *));
+    handle_error(cmd->argv);
+    cmd->argv[cmd->argc - 1] = scratch_end_word(&cmd_list->words);
+}
+
+int main(int argc, char *argv[])
+{
+    long long count = argc > 1 ? atoll(argv[1]) : 2000;
+    long long rss_mb = argc > 2 ? atoll(argv[2]) : 256;
+    if (count <= 0 || rss_mb < 0) {
+        fprintf(stderr, "Usage: %s [pipelines] [resident MB]\n", argv[0]);
+        return 1;
+    }
+
+    size_t rss = rss_mb << 20;
+    char *ballast = malloc(rss ? rss : 1);
+    handle_error(ballast);
+    memset(ballast, 1, rss);
+
+    command_list cmd_list;
+    memset(&cmd_list, 0, sizeof(cmd_list));
+    alloc_new_cmd(&cmd_list);
+
+    long long start = get_time_ns();
+    for (long long i = 0; i < count; ++i) {
+        for (int stage = 0; stage < STAGES; ++stage) {
+            if (stage)
+                alloc_new_cmd(&cmd_list);
+            add_word(&cmd_list, "/bin/true");
+        }
+        execute(&cmd_list);
+    }
+    long long elapsed = get_time_ns() - start;
+
+#ifdef SHELL_USE_FORK
+    const char *launch = "fork";
+#else
+    const char *launch = "posix_spawn";
+#endif
+    printf("%s, %lld MB resident: %lld pipelines of %d in %lld us, %.1f us per pipeline, "
+           "%.1f us per command\n", launch, rss_mb, count, STAGES, elapsed / 1000,
+           elapsed / 1e3 / count, elapsed / 1e3 / count / STAGES);
+
+    clear_cmd_list(&cmd_list);
+    scratch_free(&cmd_list.words);
+    free(ballast);
+    return 0;
+}
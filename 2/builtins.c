@@ -0,0 +1,474 @@
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "builtins.h"
+
+extern char **environ;
+
+// output of a builtin, gathered so that it takes as few write() calls as
+// possible
+typedef struct output
+{
+    int fd;
+    int failed; // e.g. EPIPE once the reader is gone, the rest is dropped
+    size_t size;
+    char buf[4096];
+} output;
+
+static void output_init(output *out, int out_fd)
+{
+    out->fd = out_fd >= 0 ? out_fd : STDOUT_FILENO;
+    out->failed = 0;
+    out->size = 0;
+}
+
+static void write_all(output *out, const char *data, size_t size)
+{
+    while (size && !out->failed) {
+        ssize_t written = write(out->fd, data, size);
+        if (written < 0) {
+            if (errno != EINTR)
+                out->failed = 1;
+            continue;
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+static void out_flush(output *out)
+{
+    write_all(out, out->buf, out->size);
+    out->size = 0;
+}
+
+static void out_write(output *out, const char *data, size_t size)
+{
+    if (sizeof(out->buf) - out->size < size)
+        out_flush(out);
+    if (size >= sizeof(out->buf)) {
+        write_all(out, data, size);
+        return;
+    }
+    memcpy(out->buf + out->size, data, size);
+    out->size += size;
+}
+
+static void out_put(output *out, char ch)
+{
+    if (out->size == sizeof(out->buf))
+        out_flush(out);
+    out->buf[out->size++] = ch;
+}
+
+static void out_puts(output *out, const char *str)
+{
+    out_write(out, str, strlen(str));
+}
+
+static void out_format(output *out, const char *format, ...)
+{
+    char buf[512];
+    va_list args, retry;
+    va_start(args, format);
+    va_copy(retry, args);
+    int size = vsnprintf(buf, sizeof(buf), format, args);
+    if (size >= (int)sizeof(buf)) {
+        char *big = malloc(size + 1);
+        handle_error(big);
+        vsnprintf(big, size + 1, format, retry);
+        out_write(out, big, size);
+        free(big);
+    } else if (size > 0) {
+        out_write(out, buf, size);
+    }
+    va_end(retry);
+    va_end(args);
+}
+
+// a whole decimal number, as test and printf take it
+static int parse_integer(const char *str, long long *value)
+{
+    char *end;
+    errno = 0;
+    *value = strtoll(str, &end, 10);
+    return end != str && !*end && !errno;
+}
+
+static int builtin_cd(command *cmd, int in_fd, int out_fd)
+{
+    const char *dir = cmd->argc > 1 ? cmd->argv[1] : getenv("HOME");
+    if (!dir || chdir(dir) < 0) {
+        fprintf(stderr, "%s\n", strerror(dir ? errno : ENOENT));
+        return 1;
+    }
+    return 0;
+}
+
+// exit [N]: N is taken modulo 256 as the status of a process is
+static int builtin_exit(command *cmd, int in_fd, int out_fd)
+{
+    int status = shell_status;
+    long long value;
+    if (cmd->argc > 1) {
+        if (parse_integer(cmd->argv[1], &value)) {
+            status = value & 0xff;
+        } else {
+            fprintf(stderr, "exit: %s: numeric argument required\n", cmd->argv[1]);
+            status = 2;
+        }
+    }
+    if (builtin_in_child)
+        _exit(status);
+    exit(status);
+}
+
+// export NAME=value...: the environment is the only place the shell keeps
+// variables, they show up in the commands it starts
+static int builtin_export(command *cmd, int in_fd, int out_fd)
+{
+    if (cmd->argc == 1) {
+        output out;
+        output_init(&out, out_fd);
+        for (char **var = environ; *var; ++var) {
+            out_puts(&out, *var);
+            out_put(&out, '\n');
+        }
+        out_flush(&out);
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; i < cmd->argc; ++i) {
+        char *value = strchr(cmd->argv[i], '=');
+        if (!value) // there are no shell variables which are not exported
+            continue;
+        if (value == cmd->argv[i]) {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", cmd->argv[i]);
+            status = 1;
+            continue;
+        }
+        *value = 0;
+        handle_error(setenv(cmd->argv[i], value + 1, 1) == 0);
+        *value = '=';
+    }
+    return status;
+}
+
+static int read_char(int in_fd)
+{
+    if (in_fd < 0)
+        return shell_getc();
+
+    unsigned char ch;
+    ssize_t size;
+    do // byte by byte, so that nothing after the line is taken from the pipe
+        size = read(in_fd, &ch, 1);
+    while (size < 0 && errno == EINTR);
+    return size == 1 ? ch : EOF;
+}
+
+static int is_blank(char ch)
+{
+    return ch == ' ' || ch == '\t';
+}
+
+// read [NAME]...: splits a line between the names on blanks, the last one
+// takes the rest of it, REPLY takes the whole line if there are no names,
+// backslashes are kept as they are
+static int builtin_read(command *cmd, int in_fd, int out_fd)
+{
+    scratch line;
+    memset(&line, 0, sizeof(line));
+    int ch;
+    while ((ch = read_char(in_fd)) != EOF && ch != '\n')
+        scratch_push(&line, ch);
+    int status = ch == EOF && !line.used;
+    char *rest = scratch_end_word(&line);
+
+    if (cmd->argc == 1)
+        handle_error(setenv("REPLY", rest, 1) == 0);
+
+    for (int i = 1; i < cmd->argc; ++i) {
+        while (is_blank(*rest))
+            ++rest;
+        char *value = rest;
+        if (i == cmd->argc - 1) {
+            char *end = rest + strlen(rest);
+            while (end > rest && is_blank(end[-1]))
+                --end;
+            *end = 0;
+        } else {
+            while (*rest && !is_blank(*rest))
+                ++rest;
+            if (*rest)
+                *rest++ = 0;
+        }
+        handle_error(setenv(cmd->argv[i], value, 1) == 0);
+    }
+
+    scratch_free(&line);
+    return status;
+}
+
+// echo [-n] [ARG]...
+static int builtin_echo(command *cmd, int in_fd, int out_fd)
+{
+    output out;
+    output_init(&out, out_fd);
+    int first = 1, newline = 1;
+    if (cmd->argc > 1 && !strcmp(cmd->argv[1], "-n")) {
+        newline = 0;
+        first = 2;
+    }
+
+    for (int i = first; i < cmd->argc; ++i) {
+        if (i > first)
+            out_put(&out, ' ');
+        out_puts(&out, cmd->argv[i]);
+    }
+    if (newline)
+        out_put(&out, '\n');
+    out_flush(&out);
+    return 0;
+}
+
+static int builtin_true(command *cmd, int in_fd, int out_fd)
+{
+    return 0;
+}
+
+static int builtin_false(command *cmd, int in_fd, int out_fd)
+{
+    return 1;
+}
+
+static int builtin_pwd(command *cmd, int in_fd, int out_fd)
+{
+    char dir[PATH_MAX];
+    if (!getcwd(dir, sizeof(dir))) {
+        fprintf(stderr, "pwd: %s\n", strerror(errno));
+        return 1;
+    }
+
+    output out;
+    output_init(&out, out_fd);
+    out_puts(&out, dir);
+    out_put(&out, '\n');
+    out_flush(&out);
+    return 0;
+}
+
+// writes the character of the escape at p, returns where it ends
+static const char* put_escape(output *out, const char *p)
+{
+    static const char escapes[] = "n\nt\tr\ra\ab\bf\fv\v\\\\";
+    const char *escape = p[1] ? strchr(escapes, p[1]) : NULL;
+    if (!escape || (escape - escapes) % 2) {
+        out_put(out, '\\');
+        return p;
+    }
+
+    out_put(out, escape[1]);
+    return p + 1;
+}
+
+// printf FORMAT [ARG]...: conversions d i u o x X c s with flags, width and
+// precision, the format is used again while arguments are left
+static int builtin_printf(command *cmd, int in_fd, int out_fd)
+{
+    if (cmd->argc < 2) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    output out;
+    output_init(&out, out_fd);
+    const char *format = cmd->argv[1];
+    int arg = 2, status = 0;
+    do {
+        int first_arg = arg;
+        for (const char *p = format; *p; ++p) {
+            if (*p == '\\') {
+                p = put_escape(&out, p);
+                continue;
+            }
+            if (*p != '%') {
+                out_put(&out, *p);
+                continue;
+            }
+            if (p[1] == '%') {
+                out_put(&out, '%');
+                ++p;
+                continue;
+            }
+
+            // the spec without the conversion goes to snprintf() as it is
+            const char *spec_start = p++;
+            p += strspn(p, "-+ #0");
+            p += strspn(p, "0123456789");
+            if (*p == '.') {
+                ++p;
+                p += strspn(p, "0123456789");
+            }
+            size_t spec_size = p - spec_start;
+            if (!*p || spec_size > 32 || !strchr("diuoxXcs", *p)) {
+                out_write(&out, spec_start, spec_size + (*p != 0));
+                if (!*p)
+                    break;
+                continue;
+            }
+
+            char spec[40];
+            memcpy(spec, spec_start, spec_size);
+            const char *value = arg < cmd->argc ? cmd->argv[arg++] : NULL;
+            long long number = 0;
+            if (strchr("diuoxX", *p) && value && !parse_integer(value, &number)) {
+                fprintf(stderr, "printf: %s: invalid number\n", value);
+                status = 1;
+            }
+
+            switch (*p) {
+                case 'c':
+                    strcpy(spec + spec_size, "c");
+                    if (value && *value)
+                        out_format(&out, spec, *value);
+                    break;
+                case 's':
+                    strcpy(spec + spec_size, "s");
+                    out_format(&out, spec, value ? value : "");
+                    break;
+                case 'd':
+                case 'i':
+                    strcpy(spec + spec_size, "lld");
+                    out_format(&out, spec, number);
+                    break;
+                default: // u o x X
+                    strcpy(spec + spec_size, "ll");
+                    spec[spec_size + 2] = *p;
+                    spec[spec_size + 3] = 0;
+                    out_format(&out, spec, (unsigned long long)number);
+                    break;
+            }
+        }
+        if (arg == first_arg) // the format takes no arguments
+            break;
+    } while (arg < cmd->argc);
+
+    out_flush(&out);
+    return status;
+}
+
+// 1 if the expression of test holds, 0 if not and -1 if it is malformed
+static int test_expr(int argc, char **argv)
+{
+    if (!argc)
+        return 0;
+    if (argc > 1 && !strcmp(argv[0], "!")) {
+        int result = test_expr(argc - 1, argv + 1);
+        return result < 0 ? result : !result;
+    }
+    if (argc == 1)
+        return argv[0][0] != 0;
+
+    if (argc == 2) {
+        const char *op = argv[0], *arg = argv[1];
+        struct stat st;
+        if (!strcmp(op, "-n"))
+            return arg[0] != 0;
+        if (!strcmp(op, "-z"))
+            return arg[0] == 0;
+        if (!strcmp(op, "-e"))
+            return stat(arg, &st) == 0;
+        if (!strcmp(op, "-f"))
+            return stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+        if (!strcmp(op, "-d"))
+            return stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+        if (!strcmp(op, "-s"))
+            return stat(arg, &st) == 0 && st.st_size > 0;
+        if (!strcmp(op, "-r"))
+            return access(arg, R_OK) == 0;
+        if (!strcmp(op, "-w"))
+            return access(arg, W_OK) == 0;
+        if (!strcmp(op, "-x"))
+            return access(arg, X_OK) == 0;
+        fprintf(stderr, "test: %s: unary operator expected\n", op);
+        return -1;
+    }
+
+    if (argc == 3) {
+        const char *left = argv[0], *op = argv[1], *right = argv[2];
+        if (!strcmp(op, "=") || !strcmp(op, "=="))
+            return !strcmp(left, right);
+        if (!strcmp(op, "!="))
+            return strcmp(left, right) != 0;
+
+        static const char *const int_ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+        for (int i = 0; i < (int)(sizeof(int_ops) / sizeof(int_ops[0])); ++i) {
+            if (strcmp(op, int_ops[i]))
+                continue;
+            long long a, b;
+            if (!parse_integer(left, &a) || !parse_integer(right, &b)) {
+                fprintf(stderr, "test: %s: integer expression expected\n",
+                        parse_integer(left, &a) ? right : left);
+                return -1;
+            }
+            switch (i) {
+                case 0: return a == b;
+                case 1: return a != b;
+                case 2: return a < b;
+                case 3: return a <= b;
+                case 4: return a > b;
+                default: return a >= b;
+            }
+        }
+        fprintf(stderr, "test: %s: binary operator expected\n", op);
+        return -1;
+    }
+
+    fprintf(stderr, "test: too many arguments\n");
+    return -1;
+}
+
+// test EXPR or [ EXPR ]: status 0 if it holds, 1 if not and 2 on an error
+static int builtin_test(command *cmd, int in_fd, int out_fd)
+{
+    int argc = cmd->argc - 1;
+    if (!strcmp(cmd->argv[0], "[")) {
+        if (!argc || strcmp(cmd->argv[argc], "]")) {
+            fprintf(stderr, "[: missing `]'\n");
+            return 2;
+        }
+        --argc;
+    }
+
+    int result = test_expr(argc, cmd->argv + 1);
+    return result < 0 ? 2 : !result;
+}
+
+// a new builtin only needs a line here
+static const builtin builtins[] = {
+    {"cd", builtin_cd, 1},
+    {"exit", builtin_exit, 1},
+    {"export", builtin_export, 1},
+    {"read", builtin_read, 1},
+    {"echo", builtin_echo, 0},
+    {"true", builtin_true, 0},
+    {"false", builtin_false, 0},
+    {"pwd", builtin_pwd, 0},
+    {"printf", builtin_printf, 0},
+    {"test", builtin_test, 0},
+    {"[", builtin_test, 0},
+};
+
+const builtin* find_builtin(const char *name)
+{
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i)
+        if (!strcmp(builtins[i].name, name))
+            return &builtins[i];
+    return NULL;
+}
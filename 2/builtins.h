@@ -0,0 +1,28 @@
+#ifndef SHELL_BUILTINS_H
+#define SHELL_BUILTINS_H
+
+#include "parser.h"
+
+// A command run by the shell itself instead of a fork() and an exec(). It
+// writes to out_fd and reads in_fd, -1 for the input of the shell, which is
+// read through the parser's buffer. Returns the exit status.
+typedef struct builtin
+{
+    const char *name;
+    int (*run)(command *cmd, int in_fd, int out_fd);
+    // changes the state of the shell, e.g. cd, so it runs in the shell only
+    // when alone and in a forked child inside a pipeline, as other shells do
+    int shell_only;
+} builtin;
+
+// exit status of the last command line, exit with no argument exits with it
+extern int shell_status;
+// set in the forked child that runs a builtin inside a pipeline, it leaves
+// with _exit() so that the stdio buffers inherited from the shell are not
+// flushed a second time
+extern int builtin_in_child;
+
+// NULL if name is not a builtin
+const builtin* find_builtin(const char *name);
+
+#endif
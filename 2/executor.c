@@ -1,96 +1,195 @@
+// pipe2()
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <spawn.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 
+#include "builtins.h"
 #include "parser.h"
 
-static int proc_builtins(command_list *cmd_list) {
-    if (cmd_list->cmd_num > 1)
-        return 0; // not builtin command
+extern char **environ;
 
-    command *first_cmd = &cmd_list->commands[0];
-    if (!strcmp("exit", first_cmd->argv[0]))
-        exit(0);
+int shell_status;
+int builtin_in_child;
 
-    if (!strcmp("cd", first_cmd->argv[0])) {
-
-        int chdir_res;
-        if (first_cmd->argc == 1)
-            chdir_res = chdir(getenv("HOME"));
-        else
-            chdir_res = chdir(first_cmd->argv[1]);
-
-        if (chdir_res < 0) {
-            fprintf(stderr, "%s\n", strerror(errno));
-        }
-
-        clear_cmd_list(cmd_list);
-        alloc_new_cmd(cmd_list);
-        return 1;
+// opens the > or >> file of cmd if it has one, -1 and an error printed if
+// it can't be opened
+static int open_output(command *cmd, int *file_fd)
+{
+    *file_fd = -1;
+    if (!cmd->output_file)
+        return 0;
+
+    *file_fd = open(cmd->output_file->filename, cmd->output_file->mode | O_CLOEXEC, 0666);
+    if (*file_fd < 0) {
+        fprintf(stderr, "%s\n", strerror(errno));
+        return -1;
     }
-
     return 0;
 }
 
-void execute(struct command_list *cmd_list)
+// runs a builtin in the shell itself, the output pipe may have no reader
+// left, then the write fails instead of killing the shell with SIGPIPE;
+// returns its exit status
+static int run_builtin(const builtin *cmd_builtin, command *cmd, int in_fd, int out_fd)
 {
-    if (!cmd_list->commands[0].argc)
-        return;
+    int file_fd;
+    if (open_output(cmd, &file_fd) < 0)
+        return 1;
+    if (file_fd >= 0)
+        out_fd = file_fd;
 
-    // check if it is built in command
-    if (proc_builtins(cmd_list))
-        return;
+    signal(SIGPIPE, SIG_IGN);
+    int status = cmd_builtin->run(cmd, in_fd, out_fd);
+    signal(SIGPIPE, SIG_DFL);
 
-    int (*pipefd)[2] = calloc(cmd_list->cmd_num - 1, sizeof(int[2]));
-    handle_error(pipefd);
+    if (file_fd >= 0)
+        close(file_fd);
+    return status;
+}
 
-    for (int i = 0; i < cmd_list->cmd_num; ++i) {
-        if (i != cmd_list->cmd_num - 1)
-            handle_error(pipe(pipefd[i]) == 0);
+// a stage reads in_fd and writes out_fd, -1 keeps the ones of the shell,
+// returns the pid or -1 if nothing was started, a builtin runs in a forked
+// child which closes all the pipes of the command line but its own ends
+static pid_t launch(command *cmd, const builtin *cmd_builtin, int in_fd, int out_fd,
+                    int (*pipefd)[2], int pipes)
+{
+    if (!cmd->argc)
+        return -1;
 
-        command *cur_cmd = &cmd_list->commands[i];
+    int file_fd;
+    if (open_output(cmd, &file_fd) < 0)
+        return -1;
+    if (file_fd >= 0)
+        out_fd = file_fd;
 
+    if (cmd_builtin) {
         pid_t pid = fork();
         handle_error(pid >= 0);
         if (!pid) {
-            if (i > 0) {
-                handle_error(dup2(pipefd[i - 1][0], 0) != -1);
-                handle_error(close(pipefd[i - 1][0]) == 0);
-            }
-            if (i < cmd_list->cmd_num - 1) {
-                handle_error(dup2(pipefd[i][1], 1) != -1);
-                handle_error(close(pipefd[i][1]) == 0);
+            if (in_fd >= 0)
+                handle_error(dup2(in_fd, 0) != -1);
+            if (out_fd >= 0)
+                handle_error(dup2(out_fd, 1) != -1);
+            for (int i = 0; i < pipes; ++i) {
+                close(pipefd[i][0]);
+                close(pipefd[i][1]);
             }
+            builtin_in_child = 1;
+            _exit(cmd_builtin->run(cmd, in_fd >= 0 ? 0 : -1, 1));
+        }
+        if (file_fd >= 0)
+            close(file_fd);
+        return pid;
+    }
 
-            if (cur_cmd->output_file) {
-                int file_fd = open(cur_cmd->output_file->filename, cur_cmd->output_file->mode, 0666);
-                handle_error(file_fd >= 0);
-
-                handle_error(dup2(file_fd, 1) != -1);
-                handle_error(close(file_fd) == 0);
-            }
+    cmd->argv = realloc(cmd->argv, (cmd->argc + 1) * sizeof(char *));
+    handle_error(cmd->argv);
+    cmd->argv[cmd->argc] = NULL;
+
+#ifndef SHELL_USE_FORK
+    // the child shares the memory of the shell until it calls exec, so no
+    // page tables are copied as fork() does
+    posix_spawn_file_actions_t actions;
+    handle_error(posix_spawn_file_actions_init(&actions) == 0);
+    if (in_fd >= 0)
+        handle_error(posix_spawn_file_actions_adddup2(&actions, in_fd, 0) == 0);
+    if (out_fd >= 0)
+        handle_error(posix_spawn_file_actions_adddup2(&actions, out_fd, 1) == 0);
+
+    pid_t pid;
+    // a command that can't be run is silently skipped as a child failing
+    // execvp() is
+    if (posix_spawnp(&pid, cmd->argv[0], &actions, NULL, cmd->argv, environ))
+        pid = -1;
+    posix_spawn_file_actions_destroy(&actions);
+#else
+    pid_t pid = fork();
+    handle_error(pid >= 0);
+    if (!pid) {
+        if (in_fd >= 0)
+            handle_error(dup2(in_fd, 0) != -1);
+        if (out_fd >= 0)
+            handle_error(dup2(out_fd, 1) != -1);
+
+        execvp(cmd->argv[0], cmd->argv);
+        exit(1);
+    }
+#endif
 
-            cur_cmd->argv = realloc(cur_cmd->argv, (cur_cmd->argc + 1) * sizeof(char *));
-            handle_error(cur_cmd->argv);
+    if (file_fd >= 0)
+        close(file_fd);
+    return pid;
+}
 
-            cur_cmd->argv[cur_cmd->argc] = NULL;
+void execute(struct command_list *cmd_list)
+{
+    if (!cmd_list->commands[0].argc)
+        return;
 
-            execvp(cur_cmd->argv[0], cur_cmd->argv);
-            exit(1);
+    int last = cmd_list->cmd_num - 1;
+    int (*pipefd)[2] = calloc(cmd_list->cmd_num, sizeof(int[2])); // the last one is unused
+    handle_error(pipefd);
+    pid_t *pids = calloc(cmd_list->cmd_num, sizeof(pid_t));
+    handle_error(pids);
+    const builtin **in_shell = calloc(cmd_list->cmd_num, sizeof(builtin *));
+    handle_error(in_shell);
+
+    // the ends are closed on exec, a stage keeps only the ones moved to 0 and 1
+    for (int i = 0; i < last; ++i)
+        handle_error(pipe2(pipefd[i], O_CLOEXEC) == 0);
+
+    // the other stages are started first, so that a builtin writing into a
+    // pipe has its reader running
+    for (int i = 0; i <= last; ++i) {
+        command *cur_cmd = &cmd_list->commands[i];
+        const builtin *cmd_builtin = cur_cmd->argc ? find_builtin(cur_cmd->argv[0]) : NULL;
+        if (cmd_builtin && (!cmd_builtin->shell_only || !last)) {
+            in_shell[i] = cmd_builtin;
+            continue;
         }
 
-        if (i != cmd_list->cmd_num - 1)
+        pids[i] = launch(cur_cmd, cmd_builtin, i > 0 ? pipefd[i - 1][0] : -1,
+                         i != last ? pipefd[i][1] : -1, pipefd, last);
+    }
+
+    // builtins in the shell don't read their input, only read does and it
+    // runs in the shell only alone
+    for (int i = 0; i < last; ++i) {
+        close(pipefd[i][0]);
+        if (!in_shell[i])
             close(pipefd[i][1]);
-        if (i != 0)
-            close(pipefd[i-1][0]);
     }
 
-    free(pipefd);
+    for (int i = 0; i <= last; ++i) {
+        if (!in_shell[i])
+            continue;
+
+        int status = run_builtin(in_shell[i], &cmd_list->commands[i], -1,
+                                 i != last ? pipefd[i][1] : -1);
+        if (i != last)
+            close(pipefd[i][1]);
+        else
+            shell_status = status;
+    }
 
-    for (int i = 0; i < cmd_list->cmd_num; ++i)
-        wait(NULL);
+    // the status of the command line is the one of its last stage, 1 if it
+    // could not be started and 128 + the signal if one killed it
+    if (!in_shell[last])
+        shell_status = 1;
+    for (int i = 0; i <= last; ++i) {
+        int status;
+        if (pids[i] > 0 && waitpid(pids[i], &status, 0) > 0 && i == last)
+            shell_status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+    }
+
+    free(pipefd);
+    free(in_shell);
+    free(pids);
 
     clear_cmd_list(cmd_list);
     alloc_new_cmd(cmd_list);
@@ -2,70 +2,130 @@
 #include <ctype.h>
 #include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include "parser.h"
 
 void execute(struct command_list *cmd_list);
 
+// stdin is read in big chunks and the lexer takes runs of plain characters
+// of a word straight from the buffer instead of a getchar() call for each
+#define INPUT_BUF_SIZE (64 * 1024)
+
+static char input_buf[INPUT_BUF_SIZE];
+static size_t input_pos, input_end;
+static int input_eof;
+
+static int refill_input()
+{
+    if (input_eof)
+        return EOF;
+
+    ssize_t size;
+    do
+        size = read(STDIN_FILENO, input_buf, sizeof(input_buf));
+    while (size < 0 && errno == EINTR);
+
+    if (size <= 0) { // an error ends the input as getchar() does
+        input_eof = 1;
+        return EOF;
+    }
+
+    input_pos = 0;
+    input_end = size;
+    return (unsigned char)input_buf[input_pos++];
+}
+
+static inline int next_char()
+{
+    if (input_pos < input_end)
+        return (unsigned char)input_buf[input_pos++];
+    return refill_input();
+}
+
+int shell_getc()
+{
+    return next_char();
+}
+
+// appends the characters ahead in the buffer up to the first stop one to
+// the word, a stop character is a space, '|' or '\\' out of quotes and
+// quote_ch or '\\' in them
+static void take_plain_chars(scratch *words, int quote_ch)
+{
+    size_t end = input_pos;
+    if (quote_ch) {
+        while (end < input_end && input_buf[end] != quote_ch && input_buf[end] != '\\')
+            ++end;
+    } else {
+        while (end < input_end && input_buf[end] != '|' && input_buf[end] != '\\' &&
+               !isspace((unsigned char)input_buf[end]))
+            ++end;
+    }
+
+    scratch_append(words, input_buf + input_pos, end - input_pos);
+    input_pos = end;
+}
+
 static void skip_spaces(int *cur_ch)
 {
     while (*cur_ch != '\n' && isspace(*cur_ch))
-        *cur_ch = getchar();
+        *cur_ch = next_char();
 }
 
 static void skip_comment(int *cur_ch)
 {
-    while (*cur_ch != '\n' && *cur_ch != EOF)
-        *cur_ch = getchar();
+    while (*cur_ch != '\n' && *cur_ch != EOF) {
+        char *newline = memchr(input_buf + input_pos, '\n', input_end - input_pos);
+        input_pos = newline ? (size_t)(newline - input_buf) : input_end;
+        *cur_ch = next_char();
+    }
 }
 
-static char* parse_word_in_quotes(int *cur_ch)
+static char* parse_word_in_quotes(int *cur_ch, scratch *words)
 {
     int quote_ch = *cur_ch;
-
-    string word = {NULL, 0, 0};
     int was_backslash = 0;
 
-    while ((*cur_ch = getchar()) != EOF) {
+    while ((*cur_ch = next_char()) != EOF) {
         if (was_backslash) {
             if (*cur_ch != quote_ch)
-                push_char(&word, '\\');
+                scratch_push(words, '\\');
             if (*cur_ch != '\\')
-                push_char(&word, *cur_ch);
+                scratch_push(words, *cur_ch);
             was_backslash = 0;
             continue;
         }
 
         if (*cur_ch == quote_ch) {
-            *cur_ch = getchar();
+            *cur_ch = next_char();
             break;
         }
 
         if (*cur_ch == '\\')
             was_backslash = 1;
-        else
-            push_char(&word, *cur_ch);
+        else {
+            scratch_push(words, *cur_ch);
+            take_plain_chars(words, quote_ch);
+        }
     }
 
-    word.buf = realloc(word.buf, (word.size + 1) * sizeof(char));
-    word.buf[word.size] = 0;
-
-    return word.buf;
+    return scratch_end_word(words);
 }
 
-static char* parse_word(int *cur_ch)
+// the word is a slice of words, NULL if it is empty
+static char* parse_word(int *cur_ch, scratch *words)
 {
     if (*cur_ch == '\'' || *cur_ch == '\"') {
-        return parse_word_in_quotes(cur_ch);
+        return parse_word_in_quotes(cur_ch, words);
     }
 
-    string word = {NULL, 0, 0};
     int was_backslash = 0;
 
     do {
         if (was_backslash) {
             if (*cur_ch != '\n')
-                push_char(&word, *cur_ch);
+                scratch_push(words, *cur_ch);
             was_backslash = 0;
             continue;
         }
@@ -74,23 +134,22 @@ static char* parse_word(int *cur_ch)
             was_backslash = 1;
         else if (isspace(*cur_ch) || *cur_ch == '|') {
             break;
-        } else
-            push_char(&word, *cur_ch);
+        } else {
+            scratch_push(words, *cur_ch);
+            take_plain_chars(words, 0);
+        }
 
-    } while ((*cur_ch = getchar()) != EOF);
+    } while ((*cur_ch = next_char()) != EOF);
 
-    if (!word.size)
+    if (words->used == words->word_start)
         return NULL;
 
-    word.buf = realloc(word.buf, (word.size + 1) * sizeof(char));
-    word.buf[word.size] = 0;
-
-    return word.buf;
+    return scratch_end_word(words);
 }
 
-static void parse_arg(int *ch, command *cur_cmd)
+static void parse_arg(int *ch, command *cur_cmd, scratch *words)
 {
-    char *arg = parse_word(ch);
+    char *arg = parse_word(ch, words);
     if (!arg)
         return;
 
@@ -101,18 +160,18 @@ static void parse_arg(int *ch, command *cur_cmd)
     cur_cmd->argv[cur_cmd->argc - 1] = arg;
 }
 
-static void parse_file(int *ch, command *cur_cmd)
+static void parse_file(int *ch, command *cur_cmd, scratch *words)
 {
     int mode = O_WRONLY | O_CREAT | O_TRUNC;
 
-    switch (*ch = getchar())
+    switch (*ch = next_char())
     {
         case EOF:
             return;
         case '>': // second
             mode ^= O_TRUNC;
             mode |= O_APPEND;
-            *ch = getchar();
+            *ch = next_char();
             // fallthrough
         default:
             skip_spaces(ch);
@@ -121,12 +180,10 @@ static void parse_file(int *ch, command *cur_cmd)
     if (*ch == EOF || *ch == '\n')
         return;
 
-    char *filename = parse_word(ch);
-    if (!cur_cmd->output_file) {
+    char *filename = parse_word(ch, words);
+    if (!cur_cmd->output_file) { // a second one rewrites it
         cur_cmd->output_file = calloc(1, sizeof(file));
         handle_error(cur_cmd->output_file);
-    } else { // rewrite file
-        free(cur_cmd->output_file->filename);
     }
 
     cur_cmd->output_file->filename = filename;
@@ -138,7 +195,7 @@ void parse_input()
     command_list *cmd_list = calloc(sizeof(*cmd_list), 1);
     handle_error(cmd_list);
     alloc_new_cmd(cmd_list);
-    int cur_ch = getchar();
+    int cur_ch = next_char();
 
     while (cur_ch != EOF) {
 
@@ -148,24 +205,25 @@ void parse_input()
                 break;
             case '\n':
                 execute(cmd_list);
-                cur_ch = getchar();
+                cur_ch = next_char();
                 break;
             case '>':
-                parse_file(&cur_ch, &cmd_list->commands[cmd_list->cmd_num - 1]);
+                parse_file(&cur_ch, &cmd_list->commands[cmd_list->cmd_num - 1], &cmd_list->words);
                 break;
             case '|':
                 alloc_new_cmd(cmd_list);
-                cur_ch = getchar();
+                cur_ch = next_char();
                 break;
             case '#':
                 skip_comment(&cur_ch);
                 break;
             default:
-                parse_arg(&cur_ch, &cmd_list->commands[cmd_list->cmd_num - 1]);
+                parse_arg(&cur_ch, &cmd_list->commands[cmd_list->cmd_num - 1], &cmd_list->words);
                 break;
         }
     }
 
     clear_cmd_list(cmd_list);
+    scratch_free(&cmd_list->words);
     free(cmd_list);
 }
\ No newline at end of file
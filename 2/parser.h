@@ -2,8 +2,22 @@
 #define SHELL_PARSER_H
 
 #include <errno.h>
+#include <stddef.h>
 #include <stdio.h>
 
+typedef struct scratch_block scratch_block;
+
+// Buffer of the words of a command line, one after another and each
+// terminated with 0. Words stay in place until the buffer is reset, so
+// argv and filenames point into it instead of owning a copy.
+typedef struct scratch
+{
+    scratch_block *block; // the current one, it links the ones before it
+    char *data;           // of the current block
+    size_t used, capacity;
+    size_t word_start;    // of the word being built
+} scratch;
+
 typedef struct file
 {
     char *filename;
@@ -21,15 +35,9 @@ typedef struct command_list
 {
     command *commands;
     int cmd_num;
+    scratch words; // of all the commands
 } command_list;
 
-typedef struct string
-{
-    char *buf;
-    int size;
-    int capacity;
-} string;
-
 #define handle_error(expr) do { \
     if (!(expr)) {                \
         fprintf(stderr, "%s\n", strerror(errno)); \
@@ -37,7 +45,27 @@ typedef struct string
     }                               \
 } while (0)
 
-void push_char(string *str, char ch);
+// moves the word being built to a block with room for size more bytes
+void scratch_grow(scratch *words, size_t size);
+
+static inline void scratch_push(scratch *words, char ch)
+{
+    if (words->used == words->capacity)
+        scratch_grow(words, 1);
+    words->data[words->used++] = ch;
+}
+
+void scratch_append(scratch *words, const char *data, size_t size);
+// terminates the word being built and returns it, the next one starts after it
+char* scratch_end_word(scratch *words);
+// drops the words, the biggest block is kept for the next command line
+void scratch_reset(scratch *words);
+void scratch_free(scratch *words);
+
+// the next character of the shell's input, for builtins reading it, so
+// that they take what the parser has buffered first
+int shell_getc();
+
 void alloc_new_cmd(command_list *cmd_list);
 void clear_cmd_list(command_list *cmd_list);
 
@@ -3,15 +3,71 @@
 
 #include "parser.h"
 
-void push_char(string *str, char ch)
+#define SCRATCH_MIN_SIZE 4096
+
+struct scratch_block
+{
+    scratch_block *prev;
+    char data[];
+};
+
+void scratch_grow(scratch *words, size_t size)
+{
+    size_t word_size = words->used - words->word_start;
+    size_t capacity = words->capacity * 2;
+    if (capacity < SCRATCH_MIN_SIZE)
+        capacity = SCRATCH_MIN_SIZE;
+    if (capacity < word_size + size)
+        capacity = word_size + size;
+
+    scratch_block *block = malloc(sizeof(scratch_block) + capacity);
+    handle_error(block);
+    if (word_size)
+        memcpy(block->data, words->data + words->word_start, word_size);
+
+    block->prev = words->block;
+    words->block = block;
+    words->data = block->data;
+    words->capacity = capacity;
+    words->used = word_size;
+    words->word_start = 0;
+}
+
+void scratch_append(scratch *words, const char *data, size_t size)
+{
+    if (words->capacity - words->used < size)
+        scratch_grow(words, size);
+    memcpy(words->data + words->used, data, size);
+    words->used += size;
+}
+
+char* scratch_end_word(scratch *words)
 {
-    if (str->size >= str->capacity) {
-        str->capacity = str->capacity * 2 + 1;
-        str->buf = realloc(str->buf, str->capacity * sizeof(char));
-        handle_error(str->buf);
+    scratch_push(words, 0);
+    char *word = words->data + words->word_start;
+    words->word_start = words->used;
+    return word;
+}
+
+void scratch_reset(scratch *words)
+{
+    if (words->block) {
+        scratch_block *prev = words->block->prev;
+        while (prev) {
+            scratch_block *next = prev->prev;
+            free(prev);
+            prev = next;
+        }
+        words->block->prev = NULL;
     }
+    words->used = words->word_start = 0;
+}
 
-    str->buf[str->size++] = ch;
+void scratch_free(scratch *words)
+{
+    scratch_reset(words);
+    free(words->block);
+    memset(words, 0, sizeof(*words));
 }
 
 void alloc_new_cmd(command_list *cmd_list)
@@ -27,17 +83,12 @@ void clear_cmd_list(command_list *cmd_list)
 {
     for (int i = 0; i < cmd_list->cmd_num; ++i) {
         command *cur_cmd = &cmd_list->commands[i];
-        for (int j = 0; j < cur_cmd->argc; ++j)
-            free(cur_cmd->argv[j]);
-
-        if (cur_cmd->output_file) {
-            free(cur_cmd->output_file->filename);
-            free(cur_cmd->output_file);
-        }
-
+        free(cur_cmd->output_file);
         free(cur_cmd->argv);
     }
 
     free(cmd_list->commands);
-    memset(cmd_list, 0, sizeof(*cmd_list));
-}
\ No newline at end of file
+    cmd_list->commands = NULL;
+    cmd_list->cmd_num = 0;
+    scratch_reset(&cmd_list->words);
+}